@@ -7,6 +7,7 @@
 
 const char* ping1Sound = "Sounds/ping1.wav";
 const char* ping2Sound = "Sounds/ping2.wav";
+const char* chatDictionary = "chat.dict";	// compression dictionary trained by the server (optional)
 
 // ImGui window flags for creating panels
 enum PanelFlags
@@ -50,6 +51,8 @@ public:
 		soundManager.load(ping1Sound);
 		soundManager.load(ping2Sound);
 
+		client.loadDictionary(chatDictionary);	// frames are compressed if the server offers the same dictionary
+
 		if (InitWinSock())
 			if (client.create());
 	}
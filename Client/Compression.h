@@ -0,0 +1,308 @@
+#pragma once
+#include "Networking.h"
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// per message compression of frames with a shared zstd dictionary
+// chat lines are too short for stream compression to find repeats in them, a dictionary trained
+// on a message log supplies those repeats up front, so each frame is compressed on its own
+//
+// only available where zstd is installed (link zstd), HAS_ZSTD is defined when it is
+// define NO_ZSTD to build without it, connections then never negotiate compression
+#if !defined(NO_ZSTD) && __has_include(<zstd.h>)
+#define HAS_ZSTD 1
+#include <zstd.h>
+#include <zdict.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "zstd.lib")
+#endif
+#endif
+
+constexpr size_t COMPRESS_THRESHOLD = 32;			// informations shorter than this are sent raw (zstd frame overhead eats the gain)
+constexpr int COMPRESSION_LEVEL = 3;				// zstd level used with the dictionary
+constexpr size_t DICTIONARY_SIZE = 16 * 1024;		// default size of a trained dictionary
+constexpr size_t MIN_TRAINING_SAMPLES = 8;			// fewer messages than this can not train a dictionary
+
+// zstd dictionary shared read only by every connection (digested once when loaded)
+class CompressionDictionary
+{
+#ifdef HAS_ZSTD
+	ZSTD_CDict* cdict = nullptr;	// digested for compression
+	ZSTD_DDict* ddict = nullptr;	// digested for decompression
+#endif
+	uint32_t dictId = 0;			// id written by the trainer, both peers must hold the same one
+
+	friend class FrameCompressor;
+
+public:
+	CompressionDictionary() {}
+	CompressionDictionary(const CompressionDictionary&) = delete;
+	CompressionDictionary& operator=(const CompressionDictionary&) = delete;
+
+	// load a trained dictionary
+	// _bytes : dictionary as written by trainDictionary
+	// returns false if zstd is not available or _bytes is not a trained dictionary
+	bool load([[maybe_unused]] std::string_view _bytes)
+	{
+#ifdef HAS_ZSTD
+		uint32_t id = ZSTD_getDictID_fromDict(_bytes.data(), _bytes.size());
+		if (id == 0)						// raw content, its id could not be negotiated
+			return false;
+
+		ZSTD_CDict* c = ZSTD_createCDict(_bytes.data(), _bytes.size(), COMPRESSION_LEVEL);
+		ZSTD_DDict* d = ZSTD_createDDict(_bytes.data(), _bytes.size());
+		if (c == nullptr || d == nullptr)
+		{
+			ZSTD_freeCDict(c);
+			ZSTD_freeDDict(d);
+			return false;
+		}
+
+		ZSTD_freeCDict(cdict);
+		ZSTD_freeDDict(ddict);
+		cdict = c;
+		ddict = d;
+		dictId = id;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// load a trained dictionary from a file
+	// returns false if the file can not be read or holds no dictionary
+	bool loadFile(const std::string& _path)
+	{
+		std::ifstream file(_path, std::ios::binary);
+		if (!file)
+			return false;
+
+		std::stringstream bytes;
+		bytes << file.rdbuf();
+		return load(bytes.str());
+	}
+
+	// returns id of loaded dictionary (0 if none)
+	uint32_t id() const {
+		return dictId;
+	}
+
+	~CompressionDictionary()
+	{
+#ifdef HAS_ZSTD
+		ZSTD_freeCDict(cdict);
+		ZSTD_freeDDict(ddict);
+#endif
+	}
+};
+
+// compression state of one connection
+// a compressed frame has frameCompressed set and its information replaced by a zstd frame
+// (the routing header of a routed frame stays raw so the server can read it)
+// compression and decompression use separate contexts and buffers, so one thread may send while another receives
+class FrameCompressor
+{
+	std::shared_ptr<const CompressionDictionary> dictionary;	// keeps the digested dictionary alive
+	size_t threshold;				// informations shorter than this stay raw
+
+#ifdef HAS_ZSTD
+	ZSTD_CCtx* cctx = nullptr;		// reused for every compressed frame
+	ZSTD_DCtx* dctx = nullptr;		// reused for every decompressed frame
+#endif
+	std::string packed;				// frame being compressed
+	std::string inflated;			// last decompressed frame (header included)
+
+public:
+	uint64_t frames = 0;			// frames sent compressed
+	uint64_t rawBytes = 0;			// their size before compression
+	uint64_t compressedBytes = 0;	// their size after compression
+
+	// _dictionary : dictionary both peers agreed on
+	// _threshold : informations shorter than this are sent raw
+	FrameCompressor(std::shared_ptr<const CompressionDictionary> _dictionary, size_t _threshold = COMPRESS_THRESHOLD)
+		:dictionary(std::move(_dictionary)), threshold(_threshold)
+	{
+#ifdef HAS_ZSTD
+		cctx = ZSTD_createCCtx();
+		dctx = ZSTD_createDCtx();
+		ZSTD_CCtx_refCDict(cctx, dictionary->cdict);
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 0);	// stream is already checked by TCP
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_dictIDFlag, 0);		// dictionary is negotiated, no need to repeat its id
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, 1);	// receiver sizes its buffer from it
+		ZSTD_DCtx_refDDict(dctx, dictionary->ddict);
+#endif
+	}
+
+	FrameCompressor(const FrameCompressor&) = delete;
+	FrameCompressor& operator=(const FrameCompressor&) = delete;
+
+	// compress an encoded frame
+	// _frame : encoded frame (header included)
+	// _out : compressed frame (header included)
+	// returns false if the frame is to be sent as it is (short, already compressed, unknown type or no gain)
+	bool compress([[maybe_unused]] std::string_view _frame, [[maybe_unused]] std::string& _out)
+	{
+#ifdef HAS_ZSTD
+		FrameHeader header;
+		if (_frame.size() < FRAME_HEADER_SIZE || !header.read(_frame.data()) || (header.flags & frameCompressed))
+			return false;
+
+		size_t keep = FRAME_HEADER_SIZE + (header.type == frameRouted ? ROUTE_HEADER_SIZE : 0);	// bytes left raw
+		if ((header.type != frameInfo && header.type != frameRouted) || _frame.size() < keep + threshold)
+			return false;
+
+		std::string_view info = _frame.substr(keep);
+		_out.resize(keep + ZSTD_compressBound(info.size()));
+		size_t size = ZSTD_compress2(cctx, &_out[keep], _out.size() - keep, info.data(), info.size());
+		if (ZSTD_isError(size) || size >= info.size())
+			return false;
+
+		_out.resize(keep + size);
+		std::memcpy(&_out[0], _frame.data(), keep);
+		header.length = uint32_t(_out.size() - FRAME_HEADER_SIZE);
+		header.flags |= frameCompressed;
+		header.write(&_out[0]);
+
+		frames++;
+		rawBytes += _frame.size();
+		compressedBytes += _out.size();
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// compress a shared frame
+	// returns the compressed frame, or _frame itself if it is to be sent as it is
+	SharedFrame compress(const SharedFrame& _frame)
+	{
+		if (!compress(*_frame, packed))
+			return _frame;
+		return std::make_shared<std::string>(packed);
+	}
+
+	// decompress the payload of a received frame with frameCompressed set
+	// _header : header of the frame, becomes the header of the raw frame
+	// _payload : payload of the frame, becomes a view of the raw payload valid until the next call
+	//            (the raw header is kept in front of it, so frameOf works on it as on a received payload)
+	// returns false if the payload is corrupted
+	bool decompress([[maybe_unused]] FrameHeader& _header, [[maybe_unused]] std::string_view& _payload)
+	{
+#ifdef HAS_ZSTD
+		size_t keep = _header.type == frameRouted ? ROUTE_HEADER_SIZE : 0;	// bytes sent raw
+		if (_payload.size() < keep)
+			return false;
+
+		std::string_view compressed = _payload.substr(keep);
+		unsigned long long size = ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+		if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR || size > MAX_FRAME_SIZE - keep)
+			return false;
+
+		inflated.resize(FRAME_HEADER_SIZE + keep + size_t(size));
+		size_t got = ZSTD_decompressDCtx(dctx, &inflated[FRAME_HEADER_SIZE + keep], size_t(size), compressed.data(), compressed.size());
+		if (ZSTD_isError(got) || got != size)
+			return false;
+
+		std::memcpy(&inflated[FRAME_HEADER_SIZE], _payload.data(), keep);
+		_header.length = uint32_t(keep + size);
+		_header.flags &= ~frameCompressed;
+		_header.write(&inflated[0]);
+
+		_payload = std::string_view(inflated).substr(FRAME_HEADER_SIZE);
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	~FrameCompressor()
+	{
+#ifdef HAS_ZSTD
+		ZSTD_freeCCtx(cctx);
+		ZSTD_freeDCtx(dctx);
+#endif
+	}
+};
+
+// train a dictionary from a message log
+// _messages : sample messages (informations or message text as it is sent)
+// _capacity : max size of the dictionary
+// returns the dictionary to save and load on both sides, or an empty string if training failed
+static std::string trainDictionary([[maybe_unused]] const std::vector<std::string>& _messages, [[maybe_unused]] size_t _capacity = DICTIONARY_SIZE)
+{
+#ifdef HAS_ZSTD
+	if (_messages.size() < MIN_TRAINING_SAMPLES)
+		return std::string();
+
+	std::string samples;					// trainer takes the samples back to back with their sizes
+	std::vector<size_t> sizes;
+	sizes.reserve(_messages.size());
+	for (auto& m : _messages)
+	{
+		samples += m;
+		sizes.push_back(m.size());
+	}
+
+	std::string dictionary(_capacity, '\0');
+	size_t size = ZDICT_trainFromBuffer(&dictionary[0], dictionary.size(), samples.data(), sizes.data(), unsigned(sizes.size()));
+	if (ZDICT_isError(size))
+	{
+		std::cerr << "Dictionary training failed : " << ZDICT_getErrorName(size) << std::endl;
+		return std::string();
+	}
+
+	dictionary.resize(size);
+	return dictionary;
+#else
+	return std::string();
+#endif
+}
+
+// receive next frame for the socket, decompressing it if it was sent compressed
+// - _compressor : compression state of this connection (nullptr if compression was not negotiated)
+// - _payload : view into _buffer or into _compressor, valid until the next receive
+static bool recvFrame(SOCKET _socketID, StreamBuffer& _buffer, FrameHeader& _header, std::string_view& _payload, FrameCompressor* _compressor)
+{
+	if (!recvFrame(_socketID, _buffer, _header, _payload))
+		return false;
+
+	if ((_header.flags & frameCompressed) && (_compressor == nullptr || !_compressor->decompress(_header, _payload)))
+	{
+		std::cerr << "Corrupted compressed frame received" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// receive information for the socket, decompressing it if it was sent compressed (routing header is skipped)
+// - _compressor : compression state of this connection (nullptr if compression was not negotiated)
+static bool recvInfo(SOCKET _socketID, StreamBuffer& _buffer, std::string& _out, FrameCompressor* _compressor)
+{
+	FrameHeader header;
+	std::string_view payload;
+	if (!recvFrame(_socketID, _buffer, header, payload, _compressor))
+		return false;
+
+	if (header.type == frameRouted)
+		payload.remove_prefix(payload.size() < ROUTE_HEADER_SIZE ? payload.size() : ROUTE_HEADER_SIZE);
+
+	_out.assign(payload.data(), payload.size());
+	return true;
+}
+
+// send information for socket, compressed if worth it
+// - _compressor : compression state of this connection (nullptr if compression was not negotiated)
+static bool sendInfo(SOCKET _socketID, const std::string& _msg, FrameCompressor* _compressor)
+{
+	if (_compressor == nullptr)
+		return sendInfo(_socketID, _msg);
+
+	std::string frame, compressed;
+	encodeFrame(frame, _msg);
+	return sendFrame(_socketID, _compressor->compress(frame, compressed) ? compressed : frame);
+}
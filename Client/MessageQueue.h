@@ -1,13 +1,406 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <utility>
 #include <vector>
 
+constexpr size_t CACHE_LINE_SIZE = 64;	// keeps producer and consumer ends of queues on separate cache lines
+constexpr size_t MAX_POOLED_NODES = 1024;	// default number of spare nodes a queue keeps for reuse
 
+// lets the single consumer of a queue sleep until producers publish something
+// producers only touch the mutex while the consumer is actually blocked
+class QueueWaiter {
+
+	alignas(CACHE_LINE_SIZE) std::atomic<bool> waiting;	// true while consumer is blocked (or about to block)
+	std::atomic<bool> closed;							// waits return instead of blocking while set
+	std::mutex mtx;										// only used to block and wake the consumer
+	std::condition_variable cv;
+
+public:
+	QueueWaiter() {
+		waiting = false;
+		closed = false;
+	}
+
+	// wake consumer if it is blocked (call after publishing)
+	void notify() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);	// pairs with fence in wait so a wakeup is never lost
+		if (waiting.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			cv.notify_one();
+		}
+	}
+
+	// block until _ready returns true, waiter is closed or _deadline passes (nullptr waits forever)
+	// returns result of _ready
+	template<typename Ready>
+	bool wait(Ready _ready, const std::chrono::steady_clock::time_point* _deadline) {
+		if (_ready())											// fast path, no lock
+			return true;
+
+		std::unique_lock<std::mutex> lock(mtx);
+		waiting.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		auto wake = [&] { return _ready() || closed.load(); };
+		if (_deadline == nullptr)	cv.wait(lock, wake);
+		else						cv.wait_until(lock, *_deadline, wake);
+
+		waiting.store(false, std::memory_order_relaxed);
+		return _ready();
+	}
+
+	// stop blocking, waits return at once
+	void close() {
+		closed = true;
+		std::lock_guard<std::mutex> lock(mtx);
+		cv.notify_all();
+	}
+
+	// allow waits to block again after close
+	void open() {
+		closed = false;
+	}
+};
+
+// lock-free multi producer / single consumer queue (intrusive Vyukov style)
+// any number of threads may enqueue, only one thread may dequeue, check isNull or dequeueAll
+// the consumer can also block until items arrive, producers only touch the mutex while it is blocked
+// nodes are recycled through a per queue pool, so steady traffic does not allocate (T must be default constructible)
 template<typename T>
 class MsgQueue {
 
+	struct MsgNode {
+		std::atomic<MsgNode*> next;		// next item in queue, or next spare node while pooled
+		T info;
+		MsgNode() :next(nullptr) {};
+	};
+
+	alignas(CACHE_LINE_SIZE) MsgNode* head;				// consumer end (dummy node, next holds oldest item)
+	alignas(CACHE_LINE_SIZE) std::atomic<MsgNode*> tail;	// producer end (newest node)
+
+	// pool of spare nodes (a stack pushed by the consumer and popped by one producer at a time, so no ABA)
+	alignas(CACHE_LINE_SIZE) std::atomic<MsgNode*> pool;
+	std::atomic_flag poolBusy = ATOMIC_FLAG_INIT;		// held by the producer popping from pool
+	std::atomic<size_t> pooled;							// nodes in pool
+	size_t maxPooled;									// nodes beyond this are freed instead of pooled
+
+	// take a spare node or allocate one (never waits, allocates if another producer is popping)
+	MsgNode* allocNode() {
+		MsgNode* n = nullptr;
+		if (!poolBusy.test_and_set(std::memory_order_acquire))
+		{
+			n = pool.load(std::memory_order_acquire);
+			while (n != nullptr && !pool.compare_exchange_weak(n, n->next.load(std::memory_order_relaxed), std::memory_order_acquire, std::memory_order_acquire));
+			poolBusy.clear(std::memory_order_release);
+		}
+
+		if (n == nullptr)
+			return new MsgNode();
+
+		pooled.fetch_sub(1, std::memory_order_relaxed);
+		n->next.store(nullptr, std::memory_order_relaxed);
+		return n;
+	}
+
+	// return a node that left the queue to the pool (consumer thread only)
+	void freeNode(MsgNode* _n) {
+		if (pooled.load(std::memory_order_relaxed) >= maxPooled)
+		{
+			delete _n;
+			return;
+		}
+
+		pooled.fetch_add(1, std::memory_order_relaxed);
+		MsgNode* top = pool.load(std::memory_order_relaxed);
+		do {
+			_n->next.store(top, std::memory_order_relaxed);
+		} while (!pool.compare_exchange_weak(top, _n, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// link a filled node at producer end
+	void push(MsgNode* _n) {
+		MsgNode* prev = tail.exchange(_n, std::memory_order_acq_rel);	// claim tail position
+		prev->next.store(_n, std::memory_order_release);				// publish to consumer
+
+		waiter.notify();
+	}
+
+	QueueWaiter waiter;									// blocks consumer while queue is empty
+
+	// block until an item is available, the queue is closed or _deadline passes (nullptr waits forever)
+	// returns true if an item is available
+	bool waitAvailable(const std::chrono::steady_clock::time_point* _deadline) {
+		return waiter.wait([this] { return !isNull(); }, _deadline);
+	}
+
+public:
+	// _maxPooled : spare nodes kept for reuse, roughly the burst size that can be absorbed without allocating
+	MsgQueue(size_t _maxPooled = MAX_POOLED_NODES) {
+		head = new MsgNode();
+		tail = head;
+		pool = nullptr;
+		pooled = 0;
+		maxPooled = _maxPooled;
+	}
+
+	// add copy of item (safe from any thread)
+	void enqueue(const T& _data) {
+		MsgNode* n = allocNode();
+		n->info = _data;
+		push(n);
+	}
+
+	// move item into queue (safe from any thread)
+	void enqueue(T&& _data) {
+		MsgNode* n = allocNode();
+		n->info = std::move(_data);
+		push(n);
+	}
+
+	// build item from arguments and move it into queue (safe from any thread)
+	template<typename... Args>
+	void emplace(Args&&... _args) {
+		enqueue(T(std::forward<Args>(_args)...));
+	}
+
+	// move oldest item out (consumer thread only)
+	// returns false if queue is empty (or the newest enqueue is not published yet)
+	bool dequeue(T& i) {
+
+		MsgNode* next = head->next.load(std::memory_order_acquire);
+		if (next == nullptr)
+			return false;
+
+		i = std::move(next->info);
+		freeNode(head);		// next becomes the new dummy
+		head = next;
+
+		return true;
+	}
+
+	// consumer thread only
+	bool isNull() {
+		return head->next.load(std::memory_order_acquire) == nullptr;
+	}
+
+	// take every available item in order (consumer thread only)
+	// returns false if nothing was taken
+	bool dequeueAll(std::vector<T>& _all)
+	{
+		T info;
+		bool any = false;
+		while (dequeue(info))
+		{
+			_all.emplace_back(std::move(info));
+			any = true;
+		}
+
+		return any;
+	}
+
+	// block until an item is available and take it (consumer thread only)
+	// returns false if queue is closed and empty
+	bool waitDequeue(T& i) {
+		return waitAvailable(nullptr) && dequeue(i);
+	}
+
+	// block up to _timeout for an item and take it (consumer thread only)
+	// returns false on timeout or if queue is closed and empty
+	bool waitDequeue(T& i, std::chrono::microseconds _timeout) {
+		auto deadline = std::chrono::steady_clock::now() + _timeout;
+		return waitAvailable(&deadline) && dequeue(i);
+	}
+
+	// block until at least one item is available and take every available item (consumer thread only)
+	// returns false if queue is closed and empty
+	bool waitDequeueAll(std::vector<T>& _all) {
+		return waitAvailable(nullptr) && dequeueAll(_all);
+	}
+
+	// stop blocking, waits return as soon as the queue is empty (items can still be added and taken)
+	void close() {
+		waiter.close();
+	}
+
+	// allow waits to block again after close
+	void open() {
+		waiter.open();
+	}
+
+	~MsgQueue()
+	{
+		while (head != nullptr)
+		{
+			MsgNode* n = head;
+			head = head->next.load(std::memory_order_relaxed);
+			delete n;
+		}
+
+		MsgNode* spare = pool.load(std::memory_order_relaxed);
+		while (spare != nullptr)
+		{
+			MsgNode* n = spare;
+			spare = spare->next.load(std::memory_order_relaxed);
+			delete n;
+		}
+	}
+};
+
+// bounded single producer / single consumer ring, capacity is rounded up to a power of two
+// one thread may push, one thread may pop, push fails while full so the producer can hold back
+template<typename T>
+class SpscRing {
+
+	std::unique_ptr<T[]> slots;		// ring storage
+	size_t mask;					// capacity - 1
+
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> readPos;	// next slot to pop (written by consumer)
+	size_t cachedWrite = 0;									// consumer's last seen writePos
+
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> writePos;	// next slot to push (written by producer)
+	size_t cachedRead = 0;									// producer's last seen readPos
+
+	QueueWaiter waiter;										// blocks consumer while ring is empty
+
+	// returns free slots, rereading consumer position only when the cached one shows less than _needed
+	size_t freeSlots(size_t _write, size_t _needed) {
+		size_t free = capacity() - (_write - cachedRead);
+		if (free < _needed)
+		{
+			cachedRead = readPos.load(std::memory_order_acquire);
+			free = capacity() - (_write - cachedRead);
+		}
+		return free;
+	}
+
+	// returns filled slots, rereading producer position only when the cached one shows none
+	size_t filledSlots(size_t _read) {
+		if (cachedWrite == _read)
+			cachedWrite = writePos.load(std::memory_order_acquire);
+		return cachedWrite - _read;
+	}
+
+public:
+	// _capacity : max items waiting (rounded up to a power of two)
+	SpscRing(size_t _capacity) {
+		size_t size = 1;
+		while (size < _capacity)
+			size <<= 1;
+
+		slots.reset(new T[size]);
+		mask = size - 1;
+		readPos = 0;
+		writePos = 0;
+	}
+
+	// max items waiting
+	size_t capacity() const {
+		return mask + 1;
+	}
+
+	// move item in (producer thread only)
+	// returns false if ring is full
+	bool push(T&& _data) {
+		size_t write = writePos.load(std::memory_order_relaxed);
+		if (freeSlots(write, 1) == 0)
+			return false;
+
+		slots[write & mask] = std::move(_data);
+		writePos.store(write + 1, std::memory_order_release);
+		waiter.notify();
+		return true;
+	}
+
+	// copy item in (producer thread only)
+	// returns false if ring is full
+	bool push(const T& _data) {
+		return push(T(_data));
+	}
+
+	// move as many of _count items in as fit, publishing them at once (producer thread only)
+	// returns number of items pushed, the rest are left untouched
+	size_t pushBatch(T* _data, size_t _count) {
+		size_t write = writePos.load(std::memory_order_relaxed);
+		size_t count = freeSlots(write, _count);
+		if (count > _count)
+			count = _count;
+		if (count == 0)
+			return 0;
+
+		for (size_t i = 0; i < count; i++)
+			slots[(write + i) & mask] = std::move(_data[i]);
+
+		writePos.store(write + count, std::memory_order_release);
+		waiter.notify();
+		return count;
+	}
+
+	// move oldest item out (consumer thread only)
+	// returns false if ring is empty
+	bool pop(T& i) {
+		size_t read = readPos.load(std::memory_order_relaxed);
+		if (filledSlots(read) == 0)
+			return false;
+
+		i = std::move(slots[read & mask]);
+		readPos.store(read + 1, std::memory_order_release);
+		return true;
+	}
+
+	// move every waiting item out in order, freeing their slots at once (consumer thread only)
+	// returns false if nothing was taken
+	bool popAll(std::vector<T>& _all) {
+		size_t read = readPos.load(std::memory_order_relaxed);
+		cachedWrite = writePos.load(std::memory_order_acquire);		// one load per batch, a cached position would leave newer items behind
+		size_t count = cachedWrite - read;
+		if (count == 0)
+			return false;
+
+		for (size_t i = 0; i < count; i++)
+			_all.emplace_back(std::move(slots[(read + i) & mask]));
+
+		readPos.store(read + count, std::memory_order_release);
+		return true;
+	}
+
+	// block until at least one item is waiting and move every waiting item out (consumer thread only)
+	// returns false if ring is closed and empty
+	bool waitPopAll(std::vector<T>& _all) {
+		return waiter.wait([this] { return !empty(); }, nullptr) && popAll(_all);
+	}
+
+	// returns true if nothing is waiting (exact on consumer thread)
+	bool empty() const {
+		return readPos.load(std::memory_order_acquire) == writePos.load(std::memory_order_acquire);
+	}
+
+	// returns true if a push would fail (exact on producer thread)
+	bool full() const {
+		return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire) >= capacity();
+	}
+
+	// stop blocking, waits return as soon as the ring is empty (items can still be pushed and popped)
+	void close() {
+		waiter.close();
+	}
+
+	// allow waits to block again after close
+	void open() {
+		waiter.open();
+	}
+};
+
+// mutex protected queue, safe for any number of producers and consumers
+template<typename T>
+class MutexQueue {
+
 	struct MsgNode {
 		MsgNode* next = nullptr;
 		T info;
@@ -18,48 +411,109 @@ class MsgQueue {
 	MsgNode* tail;
 
 	std::mutex mtx;
+	std::condition_variable waitCv;		// signalled on enqueue and close
+	bool closed = false;				// waits return instead of blocking while set (protected by mtx)
 public:
-	MsgQueue() {
+	MutexQueue() {
 		head = tail = nullptr;
 	}
 
 	void enqueue(T _data) {
 
+		MsgNode* n = new MsgNode(_data);
+
 		std::lock_guard<std::mutex> lock(mtx);
 
-		MsgNode* n = new MsgNode(_data);
 		if (tail == nullptr)
 			head = tail = n;
 		else {
 			tail->next = n;
 			tail = n;
 		}
+
+		waitCv.notify_one();
 	}
 
-	bool dequeue(T& i) {
-		if (head == nullptr) return false;
+	// block until an item is available and take it
+	// returns false if queue is closed and empty
+	bool waitDequeue(T& i) {
+		MsgNode* n;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			waitCv.wait(lock, [this] { return head != nullptr || closed; });
+
+			if (head == nullptr) return false;
 
+			n = head;
+			if (head == tail) // check for final element
+				head = tail = nullptr;
+			else
+				head = head->next;
+		}
+
+		i = n->info;
+		delete n;
+
+		return true;
+	}
+
+	// block up to _timeout for an item and take it
+	// returns false on timeout or if queue is closed and empty
+	bool waitDequeue(T& i, std::chrono::microseconds _timeout) {
+		MsgNode* n;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			waitCv.wait_for(lock, _timeout, [this] { return head != nullptr || closed; });
+
+			if (head == nullptr) return false;
+
+			n = head;
+			if (head == tail) // check for final element
+				head = tail = nullptr;
+			else
+				head = head->next;
+		}
+
+		i = n->info;
+		delete n;
+
+		return true;
+	}
+
+	// wake every waiting thread, waits return as soon as the queue is empty
+	void close() {
 		std::lock_guard<std::mutex> lock(mtx);
+		closed = true;
+		waitCv.notify_all();
+	}
+
+	bool dequeue(T& i) {
+		MsgNode* n;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+
+			if (head == nullptr) return false;
+
+			n = head;
+			if (head == tail) // check for final element
+				head = tail = nullptr;
+			else
+				head = head->next;
+		}
 
-		MsgNode* n = head;
 		i = n->info;
-		if (head == tail) // check for final element
-			head = tail = nullptr;
-		else
-			head = head->next;
 		delete n;
 
 		return true;
 	}
 
 	bool isNull() {
+		std::lock_guard<std::mutex> lock(mtx);
 		return head == nullptr;
 	}
 
 	bool dequeueAll(std::vector<T>& _all)
 	{
-		if (head == nullptr) return false;
-
 		mtx.lock();
 
 		MsgNode* newHead = head;
@@ -67,6 +521,8 @@ public:
 
 		mtx.unlock();
 
+		if (newHead == nullptr) return false;
+
 		while (newHead != nullptr)
 		{
 			T info = newHead->info;
@@ -79,4 +535,14 @@ public:
 
 		return true;
 	}
+
+	~MutexQueue()
+	{
+		while (head != nullptr)
+		{
+			MsgNode* n = head;
+			head = head->next;
+			delete n;
+		}
+	}
 };
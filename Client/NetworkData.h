@@ -1,18 +1,32 @@
 #pragma once
+#include "Schema.h"
+#include <cstdint>
 #include <string>
-#include <sstream>
+#include <string_view>
 #include <vector>
 
-constexpr auto DELIMITER = '^';
+// every struct below is sent in the binary form generated from its schema() (see Schema.h)
 
 // enum for seperating messages and information in data
-enum NetInfoType
+// fixed unsigned type so every compiler sends it as the same varint (a signed enum would be zigzag encoded)
+enum NetInfoType : uint8_t
 {
 	Null,
 	clientLeft,
 	clientJoined,
 	clientList,
-	message
+	message,
+	rosterRequest,		// client asks for roster changes since a version (or a snapshot)
+	rosterSnapshot,		// page of the full roster
+	rosterChanges,		// roster changes between two versions
+	batch				// several informations sent as one (InfoBatchView), only to clients announcing featureBatch
+};
+
+// optional protocol features a client announces in its client context
+enum ClientFeature : uint32_t
+{
+	featureBatch = 1 << 0,		// understands batch infos
+	featureCompression = 1 << 1	// holds the dictionary the server offered, frames may be compressed both ways
 };
 
 // convert enum NetInfoType to string
@@ -24,10 +38,24 @@ static std::string toString(NetInfoType _type) {
 	case clientJoined:	 return "Client Joined";
 	case clientList:	 return "Client List";
 	case message:		 return "Message";
+	case rosterRequest:	 return "Roster Request";
+	case rosterSnapshot: return "Roster Snapshot";
+	case rosterChanges:	 return "Roster Changes";
+	case batch:			 return "Batch";
 	default:			 return "ERROR";
 	}
 }
 
+// read the type of an encoded NetInfo without decoding it
+// returns Null if the type can not be read
+static NetInfoType peekType(std::string_view _data)
+{
+	uint64_t type;
+	if (!getVarint(_data, type))
+		return Null;
+	return fromWire<NetInfoType>(type);			// same decoding as the schema codec
+}
+
 // holds data for network information
 struct NetInfo
 {
@@ -37,25 +65,59 @@ struct NetInfo
 	NetInfo() :type(NetInfoType::Null), data("") {}
 	NetInfo(NetInfoType _type, std::string _data) :type(_type), data(_data) {}
 
+	static constexpr auto schema() { return std::make_tuple(field(&NetInfo::type), field(&NetInfo::data)); }
+
 	// encode network information into a string
 	// returns a string containing encoded data
 	std::string encode() {
-		return std::to_string(type) + DELIMITER + data;
+		std::string out;
+		encodeSchema(out, *this);
+		return out;
 	}
 	// decode network information from string and store in this object
 	// _data : encoded information in string
-	bool decode(std::string _data) {
-		int pos = _data.find(DELIMITER);
-		if (pos != _data.npos)
-		{
-			type = (NetInfoType)std::stoi(_data.substr(0, pos));
-			if (pos < _data.size())
-				data = _data.substr(pos + 1, _data.size());
-			else
-				data = "";
-			return true;
-		}
-		return false;
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
+	}
+};
+
+// network information decoded in place, data is a view into the encoded input (no allocation)
+struct NetInfoView
+{
+	NetInfoType type = NetInfoType::Null;	// type of network information
+	std::string_view data;					// network information data (valid while the input is)
+
+	NetInfoView() {}
+	NetInfoView(NetInfoType _type, std::string_view _data) :type(_type), data(_data) {}
+
+	static constexpr auto schema() { return std::make_tuple(field(&NetInfoView::type), field(&NetInfoView::data)); }
+
+	// append encoded information to _out
+	void encode(std::string& _out) const {
+		encodeSchema(_out, *this);
+	}
+
+	// decode from encoded information (views into _data)
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
+	}
+};
+
+// encoded informations packed into one batch info, infos are views into the encoded input (no copy)
+struct InfoBatchView
+{
+	std::vector<std::string_view> infos;	// encoded informations in the order they were queued
+
+	static constexpr auto schema() { return std::make_tuple(field(&InfoBatchView::infos)); }
+
+	// append encoded batch to _out
+	void encode(std::string& _out) const {
+		encodeSchema(_out, *this);
+	}
+
+	// decode from encoded batch (views into _data)
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
 	}
 };
 
@@ -69,36 +131,44 @@ struct Message
 	Message() :from(0), to(0), data("") {};
 	Message(int _from, int _to, std::string _data) : from(_from), to(_to), data(_data) {}
 
+	static constexpr auto schema() { return std::make_tuple(field(&Message::from), field(&Message::to), field(&Message::data)); }
+
 	// encode message to a string
 	// returns encoded message in string format
 	std::string encode() {
-
-		std::string out = "";
-		out += std::to_string(from) + DELIMITER;
-		out += std::to_string(to) + DELIMITER;
-		out += data;
+		std::string out;
+		encodeSchema(out, *this);
 		return out;
 	};
 
 	// decode message from string and store in this object
-	// _data : message in string format
+	// _data : encoded message
 	// returns true if decoding is successful
-	bool decode(const std::string _data) {
-
-		std::stringstream st(_data);
-		std::string in;
-		if (std::getline(st, in, DELIMITER))
-		{
-			from = std::stoi(in);
-			if (std::getline(st, in, DELIMITER))
-			{
-				to = std::stoi(in);
-				getline(st, in);
-				data = in;
-				return true;
-			}
-		}
-		return false;
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
+	}
+};
+
+// message decoded in place, data is a view into the encoded input (no allocation)
+struct MessageView
+{
+	int from = 0;				// id of the sender
+	int to = 0;					// id of receiver
+	std::string_view data;		// information (valid while the input is)
+
+	MessageView() {}
+	MessageView(int _from, int _to, std::string_view _data) :from(_from), to(_to), data(_data) {}
+
+	static constexpr auto schema() { return std::make_tuple(field(&MessageView::from), field(&MessageView::to), field(&MessageView::data)); }
+
+	// append encoded message to _out
+	void encode(std::string& _out) const {
+		encodeSchema(_out, *this);
+	}
+
+	// decode from encoded message (views into _data)
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
 	}
 };
 
@@ -110,79 +180,195 @@ struct User {
 	User() :id(-1), username("") {};
 	User(unsigned int _id, std::string _name) :id(_id), username(_name) {}
 
+	static constexpr auto schema() { return std::make_tuple(field(&User::id), field(&User::username)); }
+
 	// encode into string
 	// returns encoded data in string format
 	std::string encode() {
-		return std::to_string(id) + DELIMITER + username;
+		std::string out;
+		encodeSchema(out, *this);
+		return out;
 	}
 
 	// decode from string and store in this object
-	// _data : encoded data in string format
-	bool decode(std::string _data) {
-		int pos = _data.find(DELIMITER);
-		if (pos != _data.npos)
-		{
-			id = std::stoi(_data.substr(0, pos));
-			username = _data.substr(pos + 1, _data.size());
-			return true;
-		}
-		return false;
+	// _data : encoded data
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
+	}
+};
+
+// user decoded in place, username is a view into the encoded input (no allocation)
+struct UserView
+{
+	unsigned int id = 0;			// unique user id
+	std::string_view username;		// name of the user (valid while the input is)
+
+	UserView() {}
+	UserView(unsigned int _id, std::string_view _name) :id(_id), username(_name) {}
+
+	static constexpr auto schema() { return std::make_tuple(field(&UserView::id), field(&UserView::username)); }
+
+	// append encoded user to _out
+	void encode(std::string& _out) const {
+		encodeSchema(_out, *this);
+	}
+
+	// decode from encoded user (views into _data)
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
+	}
+};
+
+// one change of the server's roster
+// sent alone in clientJoined / clientLeft infos and as part of RosterChanges
+struct RosterChange
+{
+	uint64_t version;	// roster version after this change
+	bool joined;		// true if user joined, false if user left
+	User user;			// user that joined or left
+
+	RosterChange() :version(0), joined(false) {}
+	RosterChange(uint64_t _version, bool _joined, const User& _user) :version(_version), joined(_joined), user(_user) {}
+
+	static constexpr auto schema() { return std::make_tuple(field(&RosterChange::version), field(&RosterChange::joined), field(&RosterChange::user)); }
+
+	// encode into string
+	std::string encode() {
+		std::string out;
+		encodeSchema(out, *this);
+		return out;
+	}
+
+	// decode from string and store in this object
+	// _data : encoded data
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
+	}
+};
+
+// request for roster changes since a version (0 or an unknown version gets a snapshot)
+struct RosterRequest
+{
+	uint64_t version;	// roster version the client has
+
+	RosterRequest() :version(0) {}
+	RosterRequest(uint64_t _version) :version(_version) {}
+
+	static constexpr auto schema() { return std::make_tuple(field(&RosterRequest::version)); }
+
+	std::string encode() {
+		std::string out;
+		encodeSchema(out, *this);
+		return out;
+	}
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
+	}
+};
+
+// page of the server's roster at a version
+struct RosterSnapshot
+{
+	uint64_t version = 0;		// roster version of this snapshot
+	uint32_t total = 0;			// users in the whole snapshot
+	uint32_t first = 0;			// index of first user of this page
+	std::vector<User> users;	// users of this page
+
+	static constexpr auto schema() {
+		return std::make_tuple(field(&RosterSnapshot::version), field(&RosterSnapshot::total), field(&RosterSnapshot::first), field(&RosterSnapshot::users));
+	}
+
+	// returns true if this is the final page
+	bool last() const {
+		return first + users.size() >= total;
+	}
+
+	std::string encode() const {
+		std::string out;
+		encodeSchema(out, *this);
+		return out;
+	}
+
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
+	}
+};
+
+// roster changes between two versions
+struct RosterChanges
+{
+	uint64_t from = 0;					// version the changes apply to
+	uint64_t to = 0;					// version after applying them
+	std::vector<RosterChange> changes;	// changes in version order
+
+	static constexpr auto schema() { return std::make_tuple(field(&RosterChanges::from), field(&RosterChanges::to), field(&RosterChanges::changes)); }
+
+	std::string encode() const {
+		std::string out;
+		encodeSchema(out, *this);
+		return out;
+	}
+
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
 	}
 };
 
 // data containing server context
+// users are not listed here, they follow as roster snapshot or changes after the client context
 struct ServerContext
 {
-	int myId;						// id of the user to be send to
-	std::vector<User> clientList;	// list of existing users on the server
+	int myId;					// id of the user to be send to
+	uint64_t rosterVersion;		// roster version at handshake (0 from servers without a versioned roster)
+	uint32_t dictionaryId;		// id of the compression dictionary the server offers (0 for no compression)
 
-	ServerContext() :myId(-1), clientList(NULL) {}
-	ServerContext(const int& _id, const std::vector<User>& _users) :myId(_id), clientList(_users) {}
+	ServerContext() :myId(-1), rosterVersion(0), dictionaryId(0) {}
+	ServerContext(const int& _id, uint64_t _version, uint32_t _dictionaryId = 0) :myId(_id), rosterVersion(_version), dictionaryId(_dictionaryId) {}
+
+	static constexpr auto schema() {
+		return std::make_tuple(field(&ServerContext::myId), field(&ServerContext::rosterVersion, 1), field(&ServerContext::dictionaryId, 2));
+	}
 
 	// encode into string
 	// returns encoded data as string
 	std::string encode() {
-		std::string info = "";
-
-		info += std::to_string(myId);
-		for (auto& c : clientList)
-			info += DELIMITER + c.encode();
+		std::string out;
+		encode(out);
+		return out;
+	}
 
-		return info;
+	// append encoded data to _out
+	void encode(std::string& _out) const {
+		encodeSchema(_out, *this);
 	}
 
-	// decode from string and store in this object
-	// _data : encoded data in string format
-	bool decode(std::string _data) {
-		std::stringstream st(_data);
-
-		std::string in;
-		if (std::getline(st, in, DELIMITER))
-		{
-			myId = std::stoi(in);							// decode myId
-
-			while (std::getline(st, in, DELIMITER))			// read till end of the string
-			{
-				int id = std::stoi(in);						// decode id
-				std::string username;
-				std::getline(st, username, DELIMITER);			// decode name
-
-				clientList.emplace_back(User(id, username));	// create and add user
-			}
-			return true;
-		}
-		return false;
+	// decode from string and store in this object (no allocation)
+	// _data : encoded data
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
 	}
 };
 
-// stores client context data (just name for now)
+// stores client context data
 struct ClientContext
 {
-	std::string username;	// name of the client
+	std::string username;		// name of the client
+	uint64_t rosterVersion;		// roster version the client already has (0 for none or from clients without one)
+	uint32_t features;			// ClientFeature flags the client understands (0 from clients without any)
 
-	ClientContext() :username("") {};
-	ClientContext(std::string _name) :username(_name) {};
+	ClientContext() :username(""), rosterVersion(0), features(0) {};
+	ClientContext(std::string _name, uint64_t _version = 0, uint32_t _features = 0) :username(_name), rosterVersion(_version), features(_features) {};
 
-	std::string encode() { return username; }
-	bool decode(std::string _data) { username = _data; return true; }
+	static constexpr auto schema() {
+		return std::make_tuple(field(&ClientContext::username), field(&ClientContext::rosterVersion, 1), field(&ClientContext::features, 2));
+	}
+
+	std::string encode() {
+		std::string out;
+		encodeSchema(out, *this);
+		return out;
+	}
+	bool decode(std::string_view _data) {
+		return decodeSchema(_data, *this);
+	}
 };
\ No newline at end of file
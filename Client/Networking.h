@@ -1,13 +1,221 @@
 #pragma once
+#ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
-#include <iostream>
-#include <string>
 
 #pragma comment(lib, "ws2_32.lib")
 
+constexpr int SEND_FLAGS = 0;				// flags passed to every send call
+constexpr int SEND_NOWAIT_FLAGS = 0;		// no per call non-blocking flag, such sends block unless the socket is non-blocking
+#else
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+
+// map winsock names onto posix sockets so the server also builds on linux
+typedef int SOCKET;
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int SOCKET_ERROR = -1;
+constexpr int SD_BOTH = SHUT_RDWR;
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;	// report closed peers as errors instead of raising SIGPIPE
+constexpr int SEND_NOWAIT_FLAGS = MSG_NOSIGNAL | MSG_DONTWAIT;	// send what fits without blocking on a blocking socket
+
+static int closesocket(SOCKET _socketID) { return close(_socketID); }
+static int WSAGetLastError() { return errno; }
+#endif
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
 const std::string NETWORK_EXIT = "!##!##!";
 
+constexpr size_t FRAME_HEADER_SIZE = 8;					// bytes of binary header in front of every frame
+constexpr uint32_t MAX_FRAME_SIZE = 16 * 1024 * 1024;	// larger frames are treated as corrupted
+constexpr size_t RECV_CHUNK_SIZE = 4096;				// bytes requested from the socket per recv
+constexpr size_t MAX_SEND_BUFFERS = 64;					// max buffers gathered into one vectored send
+
+// kind of payload carried by a frame
+enum FrameType : uint8_t
+{
+	frameInfo = 0,		// encoded information (NetInfo, contexts or NETWORK_EXIT)
+	frameRouted = 1		// RouteHeader followed by encoded information, routed by the server without decoding it
+};
+
+// bits of FrameHeader::flags
+enum FrameFlag : uint8_t
+{
+	frameCompressed = 1 << 0	// information compressed with the dictionary negotiated at handshake (see Compression.h)
+};
+
+// fixed size header sent in front of every frame
+// layout : length (4 bytes, big endian) | type (1 byte) | flags (1 byte) | reserved (2 bytes)
+struct FrameHeader
+{
+	uint32_t length = 0;			// payload size in bytes
+	uint8_t type = frameInfo;		// FrameType of payload
+	uint8_t flags = 0;				// FrameFlag bits
+
+	// write header into _out (must hold FRAME_HEADER_SIZE bytes)
+	void write(char* _out) const
+	{
+		_out[0] = (char)(length >> 24);
+		_out[1] = (char)(length >> 16);
+		_out[2] = (char)(length >> 8);
+		_out[3] = (char)length;
+		_out[4] = (char)type;
+		_out[5] = (char)flags;
+		_out[6] = _out[7] = 0;
+	}
+
+	// read header from _in (must hold FRAME_HEADER_SIZE bytes)
+	// returns false if header is corrupted
+	bool read(const char* _in)
+	{
+		const unsigned char* in = (const unsigned char*)_in;
+		length = (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+		type = in[4];
+		flags = in[5];
+		return length <= MAX_FRAME_SIZE;
+	}
+};
+
+constexpr size_t ROUTE_HEADER_SIZE = 12;				// bytes of routing header in front of a routed frame's information
+
+// fixed size header in front of the information of a frameRouted frame
+// the server reads only this to route the frame and forwards the received bytes untouched
+// layout : type (1 byte) | reserved (3 bytes) | from (4 bytes, big endian) | to (4 bytes, big endian)
+struct RouteHeader
+{
+	uint8_t type = 0;				// NetInfoType of information
+	uint32_t from = 0;				// user id of sender
+	uint32_t to = 0;				// user id of receiver (0 for all)
+	uint32_t length = 0;			// size of information after the header (taken from frame length, not sent)
+
+	RouteHeader() {}
+	RouteHeader(uint8_t _type, uint32_t _from, uint32_t _to) :type(_type), from(_from), to(_to) {}
+
+	// write header into _out (must hold ROUTE_HEADER_SIZE bytes)
+	void write(char* _out) const
+	{
+		_out[0] = (char)type;
+		_out[1] = _out[2] = _out[3] = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			_out[4 + i] = (char)(from >> (24 - 8 * i));
+			_out[8 + i] = (char)(to >> (24 - 8 * i));
+		}
+	}
+
+	// read header from the payload of a routed frame
+	// returns false if payload is too short to hold one
+	bool read(std::string_view _payload)
+	{
+		if (_payload.size() < ROUTE_HEADER_SIZE)
+			return false;
+
+		const unsigned char* in = (const unsigned char*)_payload.data();
+		type = in[0];
+		from = (uint32_t(in[4]) << 24) | (uint32_t(in[5]) << 16) | (uint32_t(in[6]) << 8) | uint32_t(in[7]);
+		to = (uint32_t(in[8]) << 24) | (uint32_t(in[9]) << 16) | (uint32_t(in[10]) << 8) | uint32_t(in[11]);
+		length = uint32_t(_payload.size() - ROUTE_HEADER_SIZE);
+		return true;
+	}
+};
+
+// growable receive buffer owned by one connection
+// bytes are received straight into it and frames are handed out as views into it, so once it has grown
+// to the largest frame seen no allocation or copy happens per received message
+class StreamBuffer
+{
+	std::vector<char> data;	// received bytes
+	size_t readPos = 0;		// start of unparsed bytes in data
+	size_t writePos = 0;	// end of received bytes in data
+
+public:
+	StreamBuffer(size_t _capacity = 2 * RECV_CHUNK_SIZE) :data(_capacity) {}
+
+	// returns space for at least _size more bytes (fill it and call commit)
+	// views returned by nextFrame are invalidated
+	char* prepare(size_t _size)
+	{
+		if (readPos == writePos)					// everything parsed, start over
+			readPos = writePos = 0;
+
+		if (data.size() - writePos < _size)
+		{
+			if (readPos > 0)						// move unparsed bytes to front before growing
+			{
+				memmove(data.data(), data.data() + readPos, writePos - readPos);
+				writePos -= readPos;
+				readPos = 0;
+			}
+
+			if (data.size() - writePos < _size)
+				data.resize(data.size() * 2 > writePos + _size ? data.size() * 2 : writePos + _size);
+		}
+
+		return data.data() + writePos;
+	}
+
+	// returns bytes that can be written after last prepare
+	size_t space() const
+	{
+		return data.size() - writePos;
+	}
+
+	// mark _size bytes written into last prepare as received
+	void commit(size_t _size)
+	{
+		writePos += _size;
+	}
+
+	// take next complete frame if available
+	// _header : header of the frame
+	// _payload : view of the payload (valid until next prepare)
+	// _corrupted : set to true if a corrupted header is found (connection should be closed)
+	// returns true if a frame was taken
+	bool nextFrame(FrameHeader& _header, std::string_view& _payload, bool& _corrupted)
+	{
+		_corrupted = false;
+		if (writePos - readPos < FRAME_HEADER_SIZE)
+			return false;
+
+		if (!_header.read(data.data() + readPos))
+		{
+			_corrupted = true;
+			return false;
+		}
+
+		if (writePos - readPos < FRAME_HEADER_SIZE + _header.length)
+			return false;
+
+		_payload = std::string_view(data.data() + readPos + FRAME_HEADER_SIZE, _header.length);
+		readPos += FRAME_HEADER_SIZE + _header.length;
+		return true;
+	}
+
+	// take next complete frame if available and copy its payload into _payload (reuses its capacity)
+	bool nextFrame(FrameHeader& _header, std::string& _payload, bool& _corrupted)
+	{
+		std::string_view view;
+		if (!nextFrame(_header, view, _corrupted))
+			return false;
+
+		_payload.assign(view.data(), view.size());
+		return true;
+	}
+};
+
 class SocketBase
 {
 protected:
@@ -95,7 +303,7 @@ protected:
 	{
 		// accept connection
 		sockaddr_in client_address = {};
-		int client_address_len = sizeof(client_address);
+		socklen_t client_address_len = sizeof(client_address);
 		SOCKET client_socket = accept(socketID, (sockaddr*)&client_address, &client_address_len);
 
 		// check if connection accepted
@@ -160,25 +368,80 @@ public:
 // Initialize WinSock
 static bool InitWinSock()
 {
+#ifdef _WIN32
 	WSADATA wsaData;
 	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
 		std::cerr << "WSAStartup failed with error: " << WSAGetLastError() << std::endl;
 		return false;
 	}
+#endif
 	return true;
 }
 
 // Clean WinSock
 static void CleanWinSock()
 {
+#ifdef _WIN32
 	WSACleanup();
+#endif
+}
+
+// switch socket between blocking and non-blocking mode
+// returns true if mode is changed
+static bool setNonBlocking(SOCKET _socketID, bool _enable = true)
+{
+#ifdef _WIN32
+	u_long mode = _enable ? 1 : 0;
+	return ioctlsocket(_socketID, FIONBIO, &mode) == 0;
+#else
+	int flags = fcntl(_socketID, F_GETFL, 0);
+	if (flags == -1)
+		return false;
+
+	flags = _enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl(_socketID, F_SETFL, flags) == 0;
+#endif
+}
+
+// returns true if last failed socket call only failed because a non-blocking socket was not ready
+static bool wouldBlock()
+{
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+// disable nagle so small frames are sent right away instead of waiting for delayed acks
+// (frames are already written with one send each, so nagle only adds latency)
+static bool setNoDelay(SOCKET _socketID)
+{
+	int enable = 1;
+	return setsockopt(_socketID, IPPROTO_TCP, TCP_NODELAY, (const char*)&enable, sizeof(enable)) == 0;
+}
+
+// hold back partial segments while several sends are made, releasing the cork sends what is left at once
+// (overrides nagle being disabled while set, TCP_CORK on linux and TCP_NOPUSH on bsd)
+// returns false if the platform has no cork (windows)
+static bool setCork(SOCKET _socketID, bool _enable)
+{
+#if defined(TCP_CORK)
+	int enable = _enable ? 1 : 0;
+	return setsockopt(_socketID, IPPROTO_TCP, TCP_CORK, &enable, sizeof(enable)) == 0;
+#elif defined(TCP_NOPUSH)
+	int enable = _enable ? 1 : 0;
+	return setsockopt(_socketID, IPPROTO_TCP, TCP_NOPUSH, &enable, sizeof(enable)) == 0;
+#else
+	return false;
+#endif
 }
 
 // send data from given socket
 static bool sendData(SOCKET socketID, const char* info, const unsigned int& size)
 {
 	// Send the sentence to the server
-	if (send(socketID, info, size, 0) == SOCKET_ERROR) {
+	if (send(socketID, info, size, SEND_FLAGS) == SOCKET_ERROR) {
 		std::cerr << "Send failed with error: " << WSAGetLastError() << std::endl;
 		return false;
 	}
@@ -186,20 +449,17 @@ static bool sendData(SOCKET socketID, const char* info, const unsigned int& size
 	return true;
 }
 
-// recieve data for given socket
-static bool recvData(SOCKET socketID, const unsigned int& bufferSize, std::string& out)
+// recieve available data for given socket into its stream buffer
+// - socketID : socket to read from
+// - buffer : stream buffer of the connection (reused between calls)
+static bool recvData(SOCKET socketID, StreamBuffer& buffer)
 {
-	// Receive the reversed sentence from the server
-	char* buffer = new char[bufferSize];
-	int bytes_received = recv(socketID, buffer, bufferSize - 1, 0);
+	char* space = buffer.prepare(RECV_CHUNK_SIZE);
+	int bytes_received = recv(socketID, space, (int)buffer.space(), 0);
 
 	if (bytes_received > 0)
 	{
-		buffer[bytes_received] = '\0'; // Null-terminate the received data
-
-		out = std::string(buffer);
-		delete[] buffer;
-
+		buffer.commit(bytes_received);
 		return true;
 	}
 
@@ -210,39 +470,238 @@ static bool recvData(SOCKET socketID, const unsigned int& bufferSize, std::strin
 		std::cerr << "Receive failed with error: " << WSAGetLastError() << std::endl;
 	}
 
-	delete[] buffer;
 	return false;
 }
 
-// receive information for the socket
+// returns the whole frame (header included) of a payload view handed out by StreamBuffer::nextFrame
+// (payloads are kept right behind their header in the buffer)
+static std::string_view frameOf(std::string_view _payload)
+{
+	return std::string_view(_payload.data() - FRAME_HEADER_SIZE, FRAME_HEADER_SIZE + _payload.size());
+}
+
+// receive next frame for the socket
+// - _socketID : socket id of the socket
+// - _buffer : stream buffer of this connection (keeps bytes of following frames)
+// - _header : header of received frame
+// - _payload : view into _buffer, valid until the next receive on it
+static bool recvFrame(SOCKET _socketID, StreamBuffer& _buffer, FrameHeader& _header, std::string_view& _payload)
+{
+	bool corrupted;
+	while (!_buffer.nextFrame(_header, _payload, corrupted))
+	{
+		if (corrupted)
+		{
+			std::cerr << "Corrupted frame header received" << std::endl;
+			return false;
+		}
+
+		if (!recvData(_socketID, _buffer))
+			return false;
+	}
+
+	return true;
+}
+
+// receive information for the socket (routing header of a routed frame is skipped)
 // - _socketID : socket id of the socket
+// - _buffer : stream buffer of this connection (keeps bytes of following frames)
 // - _out : received information
-static bool recvInfo(SOCKET _socketID, std::string& _out)
+static bool recvInfo(SOCKET _socketID, StreamBuffer& _buffer, std::string& _out)
 {
-	std::string header;
-	if (recvData(_socketID, 100, header))
+	FrameHeader header;
+	std::string_view payload;
+	if (!recvFrame(_socketID, _buffer, header, payload))
+		return false;
+
+	if (header.type == frameRouted)
+		payload.remove_prefix(payload.size() < ROUTE_HEADER_SIZE ? payload.size() : ROUTE_HEADER_SIZE);
+
+	_out.assign(payload.data(), payload.size());
+	return true;
+}
+
+// send several buffers with a single syscall (WSASend / sendmsg)
+// - _socketID : socket id of socket
+// - _buffers : buffers to send in order
+// - _count : number of buffers (at most MAX_SEND_BUFFERS)
+// - _flags : SEND_FLAGS, or SEND_NOWAIT_FLAGS to fail with a would block error instead of waiting for socket space
+// returns bytes sent (may be less than total) or SOCKET_ERROR
+static int sendBuffers(SOCKET _socketID, const std::string_view* _buffers, size_t _count, int _flags = SEND_FLAGS)
+{
+#ifdef _WIN32
+	WSABUF bufs[MAX_SEND_BUFFERS];
+	for (size_t i = 0; i < _count; i++)
 	{
-		unsigned int size = std::stoi(header);
-		std::string info;
-		if (recvData(_socketID, size + 1, info))
+		bufs[i].buf = (CHAR*)_buffers[i].data();
+		bufs[i].len = (ULONG)_buffers[i].size();
+	}
+
+	DWORD sent = 0;
+	if (WSASend(_socketID, bufs, (DWORD)_count, &sent, _flags, NULL, NULL) == SOCKET_ERROR)
+		return SOCKET_ERROR;
+	return (int)sent;
+#else
+	iovec iov[MAX_SEND_BUFFERS];
+	for (size_t i = 0; i < _count; i++)
+	{
+		iov[i].iov_base = (void*)_buffers[i].data();
+		iov[i].iov_len = _buffers[i].size();
+	}
+
+	msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = _count;
+	return (int)sendmsg(_socketID, &msg, _flags);
+#endif
+}
+
+// send all buffers, retrying with the remaining bytes if the socket takes less
+// - _buffers : buffers to send (advanced while sending)
+// returns false if send failed
+static bool sendAllBuffers(SOCKET _socketID, std::string_view* _buffers, size_t _count)
+{
+	while (_count > 0)
+	{
+		int bytes = sendBuffers(_socketID, _buffers, _count);
+		if (bytes == SOCKET_ERROR) {
+			std::cerr << "Send failed with error: " << WSAGetLastError() << std::endl;
+			return false;
+		}
+
+		size_t sent = bytes;	// skip fully sent buffers
+		while (_count > 0 && sent >= _buffers->size())
 		{
-			_out = info;
-			return true;
+			sent -= _buffers->size();
+			_buffers++;
+			_count--;
 		}
+
+		if (_count > 0)
+			_buffers->remove_prefix(sent);
 	}
 
-	return false;
+	return true;
+}
+
+// encoded frame that can be queued on many connections without copying
+// (freed when the last connection holding it has sent it)
+typedef std::shared_ptr<const std::string> SharedFrame;
+
+// append a framed information to a buffer
+// - _out : buffer to append to
+// - _msg : information to be framed
+// - _type : FrameType of information
+static void encodeFrame(std::string& _out, std::string_view _msg, uint8_t _type = frameInfo)
+{
+	FrameHeader header;
+	header.length = (uint32_t)_msg.size();
+	header.type = _type;
+
+	size_t start = _out.size();
+	_out.resize(start + FRAME_HEADER_SIZE);
+	header.write(&_out[start]);
+	_out += _msg;
+}
+
+// encode information once into an immutable shared frame
+// - _msg : information to be framed
+// - _type : FrameType of information
+static SharedFrame makeFrame(std::string_view _msg, uint8_t _type = frameInfo)
+{
+	auto frame = std::make_shared<std::string>();
+	frame->reserve(FRAME_HEADER_SIZE + _msg.size());
+	encodeFrame(*frame, _msg, _type);
+	return frame;
+}
+
+// append a routed frame to a buffer
+// - _out : buffer to append to
+// - _route : routing header of information
+// - _info : information to be framed
+static void encodeRoutedFrame(std::string& _out, const RouteHeader& _route, std::string_view _info)
+{
+	FrameHeader header;
+	header.length = (uint32_t)(ROUTE_HEADER_SIZE + _info.size());
+	header.type = frameRouted;
+
+	size_t start = _out.size();
+	_out.resize(start + FRAME_HEADER_SIZE + ROUTE_HEADER_SIZE);
+	header.write(&_out[start]);
+	_route.write(&_out[start + FRAME_HEADER_SIZE]);
+	_out += _info;
+}
+
+// send an already encoded frame
+// - _socketID : socket id of socket
+// - _frame : encoded frame (header included)
+static bool sendFrame(SOCKET _socketID, std::string_view _frame)
+{
+	return sendAllBuffers(_socketID, &_frame, 1);
 }
 
 //send information for socker
+// header and payload go out in one vectored send without copying the payload
 // - _socketID : socket id of socket
 // - _msg : information to be send
-static bool sendInfo(SOCKET _socketID, std::string _msg)
+static bool sendInfo(SOCKET _socketID, const std::string& _msg)
 {
-	std::string size = std::to_string(_msg.size());
-	if (sendData(_socketID, size.c_str(), size.size()))
-		if (sendData(_socketID, _msg.c_str(), _msg.size()))
-			return true;
+	FrameHeader header;
+	header.length = (uint32_t)_msg.size();
 
-	return false;
+	char headerBytes[FRAME_HEADER_SIZE];
+	header.write(headerBytes);
+
+	std::string_view buffers[2] = { std::string_view(headerBytes, FRAME_HEADER_SIZE), _msg };
+	return sendAllBuffers(_socketID, buffers, 2);
+}
+
+// send several informations with as few syscalls as possible (one per MAX_SEND_BUFFERS / 2 informations)
+// - _socketID : socket id of socket
+// - _msgs : informations to be send in order
+static bool sendInfos(SOCKET _socketID, const std::vector<std::string>& _msgs)
+{
+	constexpr size_t perSend = MAX_SEND_BUFFERS / 2;	// header and payload per information
+
+	char headerBytes[perSend][FRAME_HEADER_SIZE];
+	std::string_view buffers[MAX_SEND_BUFFERS];
+
+	for (size_t first = 0; first < _msgs.size(); first += perSend)
+	{
+		size_t count = 0;
+		for (size_t i = first; i < _msgs.size() && i < first + perSend; i++, count++)
+		{
+			FrameHeader header;
+			header.length = (uint32_t)_msgs[i].size();
+			header.write(headerBytes[count]);
+
+			buffers[count * 2] = std::string_view(headerBytes[count], FRAME_HEADER_SIZE);
+			buffers[count * 2 + 1] = _msgs[i];
+		}
+
+		if (!sendAllBuffers(_socketID, buffers, count * 2))
+			return false;
+	}
+
+	return true;
+}
+
+// send several already encoded frames with as few syscalls as possible (one per MAX_SEND_BUFFERS frames)
+// - _socketID : socket id of socket
+// - _frames : encoded frames (headers included) to be send in order
+static bool sendFrames(SOCKET _socketID, const std::vector<std::string>& _frames)
+{
+	std::string_view buffers[MAX_SEND_BUFFERS];
+
+	for (size_t first = 0; first < _frames.size(); first += MAX_SEND_BUFFERS)
+	{
+		size_t count = 0;
+		for (size_t i = first; i < _frames.size() && count < MAX_SEND_BUFFERS; i++)
+			buffers[count++] = _frames[i];
+
+		if (!sendAllBuffers(_socketID, buffers, count))
+			return false;
+	}
+
+	return true;
 }
\ No newline at end of file
@@ -0,0 +1,266 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// binary wire format generated from a field list declared once per struct
+//
+// a struct opts in with
+//		static constexpr auto schema() { return std::make_tuple(field(&S::a), field(&S::b), field(&S::c, 1)); }
+// and fields are written in that order without tags or delimiters :
+//		integers, bools, enums	varint (signed values zigzag encoded, so small negatives stay short)
+//		strings					varint length + bytes (any byte allowed, std::string_view decodes as a view into the input)
+//		vectors					varint count + elements
+//		structs with a schema	varint length + fields (so readers can skip fields added after their version)
+//
+// versioning : fields are only ever appended, each tagged with the version that added it
+// a reader defaults fields missing at the end of the input if they are newer than version 0,
+// and ignores bytes after the fields it knows (sent by a newer peer)
+
+// append an unsigned integer as a little endian base 128 varint (1 byte for values below 128)
+static void putVarint(std::string& _out, uint64_t _value)
+{
+	while (_value >= 0x80)
+	{
+		_out += char(_value | 0x80);
+		_value >>= 7;
+	}
+	_out += char(_value);
+}
+
+// returns bytes putVarint appends for _value
+static size_t varintSize(uint64_t _value)
+{
+	size_t size = 1;
+	for (; _value >= 0x80; _value >>= 7)
+		size++;
+	return size;
+}
+
+// read a varint from the front of _in and advance it
+// returns false if _in ends before the varint does
+static bool getVarint(std::string_view& _in, uint64_t& _value)
+{
+	_value = 0;
+	for (int shift = 0; shift < 64 && !_in.empty(); shift += 7)
+	{
+		uint8_t byte = uint8_t(_in.front());
+		_in.remove_prefix(1);
+
+		_value |= uint64_t(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+// append a varint length followed by the bytes
+static void putBytes(std::string& _out, std::string_view _bytes)
+{
+	putVarint(_out, _bytes.size());
+	_out += _bytes;
+}
+
+// read a length prefixed byte string from the front of _in as a view into it and advance it
+// returns false if _in is too short
+static bool getBytes(std::string_view& _in, std::string_view& _out)
+{
+	uint64_t size;
+	if (!getVarint(_in, size) || size > _in.size())
+		return false;
+
+	_out = _in.substr(0, size_t(size));
+	_in.remove_prefix(size_t(size));
+	return true;
+}
+
+// read a length prefixed byte string from the front of _in and advance it
+// returns false if _in is too short
+static bool getBytes(std::string_view& _in, std::string& _out)
+{
+	std::string_view bytes;
+	if (!getBytes(_in, bytes))
+		return false;
+
+	_out.assign(bytes.data(), bytes.size());
+	return true;
+}
+
+// one field of a schema
+template<typename S, typename T>
+struct SchemaField
+{
+	T S::* member;		// member holding the value
+	unsigned since;		// version that added the field (0 for fields every peer sends)
+};
+
+// declare a schema field
+// _member : member holding the value
+// _since : version that added the field, readers default it when an older peer leaves it out
+template<typename S, typename T>
+constexpr SchemaField<S, T> field(T S::* _member, unsigned _since = 0)
+{
+	return SchemaField<S, T>{ _member, _since };
+}
+
+// struct declaring its wire fields with a static schema()
+template<typename S>
+concept HasSchema = requires { S::schema(); };
+
+template<typename T> struct IsVector : std::false_type {};
+template<typename T> struct IsVector<std::vector<T>> : std::true_type {};
+
+// returns true if field versions of a schema never decrease (new fields only appended)
+template<typename S>
+constexpr bool appendOnly()
+{
+	unsigned last = 0;
+	bool ordered = true;
+	std::apply([&](auto... _fields) { ((ordered = ordered && _fields.since >= last, last = _fields.since), ...); }, S::schema());
+	return ordered;
+}
+
+// returns version of a schema (highest version of its fields)
+template<typename S>
+constexpr unsigned schemaVersion()
+{
+	unsigned version = 0;
+	std::apply([&](auto... _fields) { ((version = _fields.since > version ? _fields.since : version), ...); }, S::schema());
+	return version;
+}
+
+// integer, bool or enum as an unsigned wire value
+template<typename T>
+constexpr uint64_t toWire(T _value)
+{
+	if constexpr (std::is_enum_v<T>)
+		return toWire(std::underlying_type_t<T>(_value));
+	else if constexpr (std::is_signed_v<T>)
+		return (uint64_t(int64_t(_value)) << 1) ^ uint64_t(int64_t(_value) >> 63);	// zigzag
+	else
+		return uint64_t(_value);
+}
+
+// unsigned wire value back to an integer, bool or enum
+template<typename T>
+constexpr T fromWire(uint64_t _wire)
+{
+	if constexpr (std::is_enum_v<T>)
+		return T(fromWire<std::underlying_type_t<T>>(_wire));
+	else if constexpr (std::is_same_v<T, bool>)
+		return _wire != 0;
+	else if constexpr (std::is_signed_v<T>)
+		return T(int64_t(_wire >> 1) ^ -int64_t(_wire & 1));
+	else
+		return T(_wire);
+}
+
+template<typename T> void writeValue(std::string& _out, const T& _value);
+template<typename T> bool readValue(std::string_view& _in, T& _value);
+
+// append the fields of a struct in schema order
+template<typename S>
+void writeFields(std::string& _out, const S& _value)
+{
+	std::apply([&](auto... _fields) { (writeValue(_out, _value.*(_fields.member)), ...); }, S::schema());
+}
+
+// read the fields of a struct from all of _in
+// returns false if a field is corrupted or a version 0 field is missing
+template<typename S>
+bool readFields(std::string_view _in, S& _value)
+{
+	static_assert(appendOnly<S>(), "schema fields must be appended in version order");
+
+	auto read = [&](auto _field) {
+		auto& member = _value.*(_field.member);
+		if (!_in.empty())
+			return readValue(_in, member);
+
+		member = std::remove_reference_t<decltype(member)>();	// added after the writer's version
+		return _field.since > 0;
+	};
+	return std::apply([&](auto... _fields) { return (read(_fields) && ...); }, S::schema());
+}
+
+template<typename T>
+void writeValue(std::string& _out, const T& _value)
+{
+	if constexpr (HasSchema<T>)
+	{
+		size_t start = _out.size();
+		_out += '\0';									// length placeholder, one byte covers fields below 128 bytes
+		writeFields(_out, _value);
+
+		size_t size = _out.size() - start - 1;
+		if (size < 0x80)
+			_out[start] = char(size);
+		else
+		{
+			std::string prefix;							// longer varint, fields move up (short string, no allocation)
+			putVarint(prefix, size);
+			_out.replace(start, 1, prefix);
+		}
+	}
+	else if constexpr (IsVector<T>::value)
+	{
+		putVarint(_out, _value.size());
+		for (auto& v : _value)
+			writeValue(_out, v);
+	}
+	else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+		putBytes(_out, _value);
+	else
+		putVarint(_out, toWire(_value));
+}
+
+template<typename T>
+bool readValue(std::string_view& _in, T& _value)
+{
+	if constexpr (HasSchema<T>)
+	{
+		std::string_view fields;
+		return getBytes(_in, fields) && readFields(fields, _value);
+	}
+	else if constexpr (IsVector<T>::value)
+	{
+		uint64_t count;
+		if (!getVarint(_in, count) || count > _in.size())		// every element takes at least one byte
+			return false;
+
+		_value.resize(size_t(count));
+		for (auto& v : _value)
+			if (!readValue(_in, v))
+				return false;
+		return true;
+	}
+	else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>)
+		return getBytes(_in, _value);
+	else
+	{
+		uint64_t wire;
+		if (!getVarint(_in, wire))
+			return false;
+		_value = fromWire<T>(wire);
+		return true;
+	}
+}
+
+// append binary form of a struct with a schema (fields only, the frame carries the length)
+template<typename S>
+void encodeSchema(std::string& _out, const S& _value)
+{
+	writeFields(_out, _value);
+}
+
+// decode binary form of a struct with a schema from all of _in
+// string_view members become views into _in
+// returns false if _in is corrupted
+template<typename S>
+bool decodeSchema(std::string_view _in, S& _value)
+{
+	return readFields(_in, _value);
+}
@@ -1,9 +1,12 @@
 #pragma once
 #include "Networking.h"
 #include "NetworkData.h"
+#include "Compression.h"
 #include "MessageQueue.h"
 #include <map>
 
+constexpr size_t SEND_QUEUE_SIZE = 256;	// max messages waiting for the sending thread
+
 struct UserData
 {
 	std::string username;
@@ -18,21 +21,50 @@ struct UserData
 
 class Client :public SocketBase
 {
-	MsgQueue<std::string> sendQueue;
+	SpscRing<std::string> sendQueue;	// encoded frames from ui thread (only producer) to sending thread
+	StreamBuffer recvBuffer;		// received bytes not yet parsed into frames
 
-	std::thread* sendThread;		// sending thread
-	std::thread* recvThread;		// recving thread
+	std::thread* sendThread = nullptr;	// sending thread
+	std::thread* recvThread = nullptr;	// recving thread
+	bool sending = false;			// true once the sending thread runs for this connection (it is then the only writer)
 
 	std::map<int, UserData> userData;	// user data contains {userId, (username, userchat)}
 	std::mutex mtx;						// mutex to protect userData
 
 	int myId;						// this client id on server
 
+	uint64_t rosterVersion = 0;		// version of the server roster userData reflects (kept across reconnects, 0 for none)
+	bool rosterSynced = false;		// a sync answer arrived and no change went missing since (receiving thread only)
+	std::vector<User> rosterPages;	// users of snapshot pages received so far
+	std::mutex writeMtx;			// serializes socket writes of the sending thread and roster requests of the receiving thread
+
+	std::shared_ptr<const CompressionDictionary> dictionary;	// dictionary this client can compress with (none if null)
+	std::unique_ptr<FrameCompressor> compressor;				// set while the server agreed to compress frames
+
 	std::atomic<int> newMessageIn;	// to play notification sound
+
+	// wait for the threads of the previous connection to end and free them
+	// (its sending thread may still be popping the queue, so this comes before the queue is reopened)
+	void joinThreads()
+	{
+		if (sendThread != nullptr)
+		{
+			sendThread->join();
+			delete sendThread;
+			sendThread = nullptr;
+		}
+
+		if (recvThread != nullptr)
+		{
+			recvThread->join();
+			delete recvThread;
+			recvThread = nullptr;
+		}
+	}
 public:
 	std::string username;			// this client name
 
-	Client() {
+	Client() :sendQueue(SEND_QUEUE_SIZE) {
 		newMessageIn.store(-1);
 	}
 
@@ -42,15 +74,22 @@ public:
 	// returns if connection is successfull or not
 	bool connect(std::string host, const unsigned int& port)
 	{
+		joinThreads();					// threads of a lost connection end on their own once it is gone
+
 		if (!SocketBase::connectServer(host, port))
 			return false;
 
+		recvBuffer = StreamBuffer();	// drop bytes left from a previous connection
+		sending = false;
+		rosterSynced = false;			// the server answers our client context with a sync
+
 		connected = true;
+		setNoDelay(socketID);			// chat frames are small, do not hold them back
 
 		std::string ctx;
 
 		// receive server context
-		if (!recvInfo(socketID, ctx))
+		if (!recvInfo(socketID, recvBuffer, ctx))
 		{
 			std::cout << "Server Context failed" << std::endl;
 			disconnect();
@@ -70,10 +109,22 @@ public:
 
 		// set data from server context
 		myId = sc.myId;
-		populateUsers(sc.clientList);
+
+		// compress only with the very dictionary the server offered
+		uint32_t features = featureBatch;
+		compressor.reset();
+		if (dictionary && sc.dictionaryId != 0 && sc.dictionaryId == dictionary->id())
+		{
+			compressor = std::make_unique<FrameCompressor>(dictionary);
+			features |= featureCompression;
+		}
+
+		mtx.lock();								// critical section begin
+		userData.insert({ 0, UserData("General", "") });
+		mtx.unlock();							// critical section end
 
 		// send client sontext
-		ClientContext cc(username);				// prepare client context
+		ClientContext cc(username, rosterVersion, features);	// prepare client context (users follow as roster changes since our version or a snapshot)
 		if (!sendInfo(socketID, cc.encode()))	// encode and send client context
 		{
 			std::cout << "Client context Not sent" << std::endl;
@@ -81,31 +132,58 @@ public:
 			return false;
 		}
 
+		sendQueue.open();												// let sending thread sleep on queue again
+		sending = true;
 		sendThread = new std::thread(&Client::sendInfoThread, this);	// start sending thread for this client
 		recvThread = new std::thread(&Client::recvInfoThread, this);	// start receiving thread for this client
 
 		return true;
 	}
 
-	// populate users received from server
-	// _users : list of users
+	// replace users with the roster received in snapshot pages
+	// users no longer on the server are removed, new ones announced
+	// _users : every user of the snapshot
 	void populateUsers(std::vector<User>& _users)
 	{
 		std::lock_guard<std::mutex> lock(mtx);							// critical section
 
-		userData.insert({ 0, UserData("General", "") });
+		std::map<int, UserData> users;
+		users[0] = userData[0];											// general chat stays
 		for (auto& u : _users)
 		{
-			userData.insert({ u.id, UserData(u.username, "") });
-			userData[0].chat += "\n\n" + u.username + " Joined :)\n";	// add join message to general chat
+			if (u.id == myId)
+				continue;
+
+			auto old = userData.find(u.id);
+			if (old != userData.end())
+				users[u.id] = old->second;								// keep chat with known user
+			else
+			{
+				users[u.id] = UserData(u.username, "");
+				users[0].chat += "\n\n" + u.username + " Joined :)\n";	// add join message to general chat
+			}
 		}
+		userData.swap(users);
 	}
 
 	// recieve info from server
 	// _out : recieved info
 	// return true if received successfully
 	bool recv(std::string& _out) {
-		return connected = recvInfo(socketID, _out);
+		return connected = recvInfo(socketID, recvBuffer, _out, compressor.get());
+	}
+
+	// set dictionary to compress frames with if the server offers the same one (call before connect)
+	// _path : file written by the server's -train mode
+	// returns false if the file holds no dictionary or compression is not available in this build
+	bool loadDictionary(const std::string& _path)
+	{
+		auto d = std::make_shared<CompressionDictionary>();
+		if (!d->loadFile(_path))
+			return false;
+
+		dictionary = d;
+		return true;
 	}
 
 	// send message to server
@@ -127,71 +205,146 @@ public:
 		auto sendTo = userData.begin();
 		std::advance(sendTo, to);
 
-		sendTo->second.chat += "\nYou  : " + _msg;				// add own message to chat
 		Message data(myId, sendTo->first, _msg);				// prepare message
+		NetInfo newInfo(NetInfoType::message, data.encode());	// encode message
 
-		mtx.unlock();											// critical section end
+		std::string frame;										// routing header lets the server forward it without decoding
+		encodeRoutedFrame(frame, RouteHeader(NetInfoType::message, myId, sendTo->first), newInfo.encode());
 
-		NetInfo newInfo(NetInfoType::message, data.encode());	// encode message
-		sendQueue.enqueue(newInfo.encode());					// add message to sending queue
+		if (!sendQueue.push(std::move(frame)))					// add message to sending queue
+		{
+			mtx.unlock();										// critical section end
+			std::cout << "Send Queue full. Message not sent - " << _msg << std::endl;
+			return false;										// caller keeps the message and retries
+		}
+
+		sendTo->second.chat += "\nYou  : " + _msg;				// add own message to chat
+
+		mtx.unlock();											// critical section end
 
 		std::cout << "Added to Send Queue - " << _msg << std::endl;
 
 		return true;
 	}
-	// callback to handle new user 
-	// _info : network info of new user
-	void onUserJoined(const NetInfo& _info)
+	// apply one roster change (joins of known users and leaves of unknown ones are ignored,
+	// a batch can carry the leave of a user that joined and left before we heard of it)
+	void applyChange(const RosterChange& _change)
 	{
-		User newUser;											// create user
-		if (!newUser.decode(_info.data))						// decode user data
-		{
-			std::cout << "Client join information is corrupted" << std::endl;
+		if (_change.user.id == myId)							// check if user is me
 			return;
+
+		std::lock_guard<std::mutex> lock(mtx);					// critical section
+
+		if (_change.joined)
+		{
+			if (userData.insert({ _change.user.id, UserData(_change.user.username, "") }).second)	// add new user to the user list
+				userData[0].chat += "\n\n" + _change.user.username + " Joined :)\n";				// add join message to general chat
+		}
+		else
+		{
+			if (userData.erase(_change.user.id) > 0)													// remove user from userlist
+				userData[0].chat += "\n\n" + _change.user.username + " Left :(\n";				// add left message in general chat
 		}
+	}
 
-		if (newUser.id == myId)									// check if new user is me
+	// ask the server for the whole roster after a change went missing (answered with snapshot pages)
+	// changes are dropped until a sync answer arrives, so only one request is made
+	void requestSnapshot()
+	{
+		if (!rosterSynced)										// an answer is already on its way
 			return;
 
-		mtx.lock();												//critical section begin
+		rosterSynced = false;
+		std::cout << "Roster changes missing, requesting snapshot" << std::endl;
+
+		std::string info = NetInfo(NetInfoType::rosterRequest, RosterRequest(0).encode()).encode();
+		std::lock_guard<std::mutex> lock(writeMtx);				// critical section
+		sendInfo(socketID, info);
+	}
 
-		userData.insert({ newUser.id,UserData(newUser.username, "") });		// add new user to the user list
+	// callback to handle user join or exit
+	// changes already covered by our roster version are ignored, a change that skips versions means some went missing
+	// _info : network info of user joined or left
+	void onUserChanged(const NetInfoView& _info)
+	{
+		RosterChange change;
+		if (!change.decode(_info.data))							// decode change
+		{
+			std::cout << "Client join / exit information is corrupted" << std::endl;
+			return;
+		}
 
-		userData[0].chat += "\n\n" +
-			newUser.username + " Joined :)\n";					// add join message to general chat
+		if (change.version <= rosterVersion)
+			return;
 
-		mtx.unlock();											// critical section end
+		if (change.version != rosterVersion + 1)				// versions in between never reached us
+		{
+			requestSnapshot();
+			return;
+		}
+
+		change.joined = _info.type == NetInfoType::clientJoined;
+		applyChange(change);
+		rosterVersion = change.version;
 	}
 
-	// callback to handle user exit
-	// _info : network info of user left
-	void onUserExit(const NetInfo& _info)
+	// callback to handle a roster snapshot page, users are replaced once the last page arrives
+	// _info : network info of the page
+	void onRosterSnapshot(const NetInfoView& _info)
 	{
-		User newUser;											// create user
-		if (!newUser.decode(_info.data))						// decode user data
+		RosterSnapshot page;
+		if (!page.decode(_info.data))
 		{
-			std::cout << "Client exit information is corrupted" << std::endl;
+			std::cout << "Roster snapshot is corrupted" << std::endl;
 			return;
 		}
 
-		if (newUser.id == myId)
-			return;
+		if (page.first == 0)
+			rosterPages.clear();
+		rosterPages.insert(rosterPages.end(), page.users.begin(), page.users.end());
 
-		mtx.lock();												// critical section begin
+		if (page.last())
+		{
+			populateUsers(rosterPages);
+			rosterPages.clear();
+			rosterVersion = page.version;
+			rosterSynced = true;
+		}
+	}
 
-		userData.erase(newUser.id);								// remove user from userlist
+	// callback to handle roster changes since a version
+	// a set may start before our version (we synced after its base, changes we hold are skipped),
+	// a set starting after our version is discarded and the whole roster requested
+	// _info : network info of the changes
+	void onRosterChanges(const NetInfoView& _info)
+	{
+		RosterChanges delta;
+		if (!delta.decode(_info.data))
+		{
+			std::cout << "Roster changes are corrupted" << std::endl;
+			return;
+		}
 
-		userData[0].chat += "\n\n" +
-			newUser.username + " Left :(\n";					// add left message in general chat
+		if (delta.from > rosterVersion)							// changes between our version and its base never reached us
+		{
+			requestSnapshot();
+			return;
+		}
 
-		mtx.unlock();											// critical section end
+		for (auto& c : delta.changes)
+			if (c.version > rosterVersion)
+				applyChange(c);
+
+		if (delta.to > rosterVersion)
+			rosterVersion = delta.to;
+		rosterSynced = true;
 	}
 
 	// callback to handle message
 	// _info : network information of the message received
-	void onMsgRecvd(const NetInfo& _info)
+	void onMsgRecvd(const NetInfoView& _info)
 	{
-		Message msg;											// create message
+		MessageView msg;										// message viewed in place
 		if (!msg.decode(_info.data))							// decode message
 		{
 			std::cout << "Message is corrupted" << std::endl;
@@ -202,21 +355,40 @@ public:
 			return;
 
 		int chat = msg.to == 0 ? 0 : msg.from;					// find chat index in user list (if to is 0 that means its for general chat)
-		userData[chat].chat += "\n" +
-			userData[msg.from].username + "  : " + msg.data;	// add message to the chat 
+		std::string& text = userData[chat].chat;				// add message to the chat
+		text += "\n";
+		text += userData[msg.from].username;
+		text += "  : ";
+		text += msg.data;
 
 		userData[chat].newMsgs += 1;							// add new message notification counter
 
 		newMessageIn.store(chat);
 	}
 
+	// callback to handle a batch of informations
+	// _info : network information of the batch received
+	void onBatchRecvd(const NetInfoView& _info)
+	{
+		InfoBatchView batch;									// views into the received frame
+		if (!batch.decode(_info.data))
+		{
+			std::cout << "Batch is corrupted" << std::endl;
+			return;
+		}
+
+		for (auto& i : batch.infos)								// handle each as if it came in its own frame
+			if (peekType(i) != NetInfoType::batch)
+				onInfoRecvd(i);
+	}
+
 	// callback to handle received information
 	// process information according to type
 	// _info : received information
-	void onInfoRecvd(std::string _info)
+	void onInfoRecvd(std::string_view _info)
 	{
 		std::cout << _info << std::endl;
-		NetInfo newInfo;										// create information
+		NetInfoView newInfo;									// information viewed in place, handlers copy what they keep
 		if (!newInfo.decode(_info))								// decode information
 		{
 			std::cout << "Information received is corrupted" << std::endl;
@@ -227,23 +399,43 @@ public:
 
 		switch (newInfo.type)
 		{
-		case NetInfoType::clientJoined: onUserJoined(newInfo);
+		case NetInfoType::clientJoined:
+		case NetInfoType::clientLeft: onUserChanged(newInfo);
+			break;
+		case NetInfoType::rosterSnapshot: onRosterSnapshot(newInfo);
 			break;
-		case NetInfoType::clientLeft: onUserExit(newInfo);
+		case NetInfoType::rosterChanges: onRosterChanges(newInfo);
 			break;
 		case NetInfoType::message: onMsgRecvd(newInfo);
 			break;
+		case NetInfoType::batch: onBatchRecvd(newInfo);
+			break;
 		}
 	}
 
 	// handles sending thread of this client
+	// runs until the queue is closed and drained, so the exit frame queued by disconnect goes out last
 	void sendInfoThread()
 	{
-		std::string msg;
-		while (connected)
+		std::vector<std::string> frames;
+		std::string compressed;
+		while (sendQueue.waitPopAll(frames))					// sleep until messages are queued, flush everything pending at once
 		{
-			if (sendQueue.dequeue(msg))
-				connected = sendInfo(socketID, msg);
+			if (compressor)										// only this thread compresses
+				for (auto& f : frames)
+					if (compressor->compress(f, compressed))
+						f.swap(compressed);
+
+			writeMtx.lock();									// critical section begin
+			bool sent = sendFrames(socketID, frames);
+			writeMtx.unlock();									// critical section end
+
+			if (!sent)
+			{
+				connected = false;
+				break;
+			}
+			frames.clear();
 		}
 
 		std::cout << "Send Thread Closed" << std::endl;
@@ -259,6 +451,8 @@ public:
 				onInfoRecvd(msg);
 		}
 
+		sendQueue.close();										// connection lost, wake sending thread
+
 		std::cout << "Recieve Thread Closed" << std::endl;
 	}
 
@@ -325,8 +519,18 @@ public:
 	{
 		if (connected)
 		{
-			sendInfo(socketID, NETWORK_EXIT);					// send disconnection message to server
+			if (sending)										// sending thread is the only writer, exit frame goes through its queue
+			{
+				std::string frame;
+				encodeFrame(frame, NETWORK_EXIT);
+				while (connected && !sendQueue.push(frame))		// queue full, wait for sending thread to make room
+					std::this_thread::yield();
+			}
+			else
+				sendInfo(socketID, NETWORK_EXIT);				// send disconnection message to server
+
 			connected = false;									// set connection to false
+			sendQueue.close();									// sending thread exits once the queue is drained
 			return true;
 		}
 
@@ -341,13 +545,7 @@ public:
 	// destructor
 	~Client()
 	{
-		if (sendThread != nullptr)
-			sendThread->join();
-
-		if (recvThread != nullptr)
-			recvThread->join();
-
-		delete sendThread, recvThread;
+		joinThreads();
 		std::cout << "\nClient Destroyed.." << std::endl;
 	}
 };
\ No newline at end of file
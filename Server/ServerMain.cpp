@@ -1,24 +1,201 @@
-
 #include "server.h"
+#include "eventServer.h"
+#include <cstdlib>
+#include <fstream>
 #include <thread>
 
-int main()
+// print how often overflow policies of outbound queues fired
+static void printOutboundStats(OutboundStats& _stats)
 {
-	if (InitWinSock())
+	std::cout << "Outbound : " << _stats.droppedMessages << " messages and " << _stats.droppedPresence << " presence updates dropped, "
+		<< _stats.overLimit << " pushes over limits, " << _stats.disconnects << " slow consumers disconnected" << std::endl;
+}
+
+// print outbound counters of the threaded server every _period (until the process ends)
+static void printThreadedStats(Server& _server, std::chrono::seconds _period)
+{
+	while (true)
+	{
+		std::this_thread::sleep_for(_period);
+		printOutboundStats(_server.outboundStats());
+	}
+}
+
+// print write metrics of an event loop server every _period (until the process ends)
+static void printWriteMetrics(EventServer& _server, std::chrono::seconds _period)
+{
+	while (true)
+	{
+		std::this_thread::sleep_for(_period);
+
+		WriteMetrics m = _server.writeMetrics();
+		std::cout << "Writes : " << m.immediateWrites << " immediate, " << m.coalescedWrites << " coalesced, "
+			<< m.coalescingConnections << " connections coalescing, batches " << _server.outboundStats().batches
+			<< " (" << _server.outboundStats().batchedInfos << " infos)" << std::endl;
+
+		std::cout << "Informations per write :";
+		for (size_t i = 0; i < WRITE_HISTOGRAM_BUCKETS; i++)
+		{
+			size_t low = i == 0 ? 1 : (size_t(1) << (i - 1)) + 1;
+			size_t high = size_t(1) << i;
+			if (i + 1 == WRITE_HISTOGRAM_BUCKETS)
+				std::cout << " " << low << "+";
+			else if (low == high)
+				std::cout << " " << low;
+			else
+				std::cout << " " << low << "-" << high;
+			std::cout << ":" << m.infosPerWrite[i];
+		}
+		std::cout << std::endl;
+
+		OutboundStats& s = _server.outboundStats();
+		if (s.compressedFrames > 0)
+			std::cout << "Compression : " << s.compressedFrames << " frames, " << s.rawBytes << " -> " << s.compressedBytes << " bytes" << std::endl;
+		printOutboundStats(s);
+	}
+}
+
+// train a compression dictionary from a message log and save it
+// _log : captured messages, one per line
+// _path : file to write the dictionary to (load it with -dict, clients read it as chat.dict)
+// returns process exit code
+static int trainFromLog(const char* _log, const char* _path)
+{
+	std::ifstream log(_log);
+	if (!log)
+	{
+		std::cout << "Message log " << _log << " can not be read" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> samples;		// messages as they are compressed on the wire
+	std::string line;
+	while (std::getline(log, line))
+		if (!line.empty())
+			samples.push_back(NetInfo(NetInfoType::message, Message(0, 0, line).encode()).encode());
+
+	std::string dictionary = trainDictionary(samples);
+	if (dictionary.empty())
+	{
+		std::cout << "No dictionary trained from " << samples.size() << " messages (zstd missing or too few messages)" << std::endl;
+		return 1;
+	}
+
+	std::ofstream out(_path, std::ios::binary);
+	out.write(dictionary.data(), dictionary.size());
+	if (!out)
 	{
-		Server server;
-		if (server.create())
+		std::cout << "Dictionary can not be written to " << _path << std::endl;
+		return 1;
+	}
+
+	std::cout << "Trained " << dictionary.size() << " byte dictionary from " << samples.size() << " messages into " << _path << std::endl;
+	return 0;
+}
+
+// create, bind and start server then accept clients forever
+// _started : called once the server is started
+// _args : arguments forwarded to start
+template<typename T, typename Started, typename... Args>
+static void run(T& server, Started _started, Args... _args)
+{
+	if (server.create())
+	{
+		if (server.bind(65432))
 		{
-			if (server.bind(65432))
+			if (server.start(_args...))
 			{
-				if (server.start())
-				{
-					while (true)
-						server.accept();
-				}
+				_started();
+				while (true)
+					server.accept();
 			}
+		}
+
+		server.destroy();
+	}
+}
 
-			server.destroy();
+int main(int argc, char* argv[])
+{
+	// event loop server by default, "-threaded" runs the thread per client server
+	// "-uring" makes event loops write through io_uring where available
+	// "-presence <ms>" sets how long joins and leaves are batched (0 broadcasts each at once)
+	// "-validate" fully decodes routed messages and checks them against their routing header
+	// "-no-utf8" routes message text without UTF-8 validation, "-strip" removes control characters from it
+	// "-coalesce <us>" sets how long event loops may hold writes back to merge them (0 always writes immediately)
+	// "-max-bytes <n>" and "-max-frames <n>" cap what is queued per connection, "-grace <ms>" is how long a connection
+	// may stay over them before it is disconnected
+	// "-keep-messages" never drops queued messages to get under the caps, "-drop-presence" drops queued presence updates
+	// "-stats <s>" prints outbound queue counters (and write metrics of the event loop server) every s seconds
+	// "-dict <file>" offers frame compression with a trained dictionary to clients holding the same one
+	// "-train <log> <file>" trains a dictionary from a message log (one message per line) and exits
+	bool threaded = false;
+	bool validate = false;
+	bool validateUtf8 = true;
+	bool strip = false;
+	IoBackend backend = IoBackend::readiness;
+	std::chrono::milliseconds presenceWindow = PRESENCE_WINDOW;
+	CoalescePolicy coalesce;
+	OutboundLimits limits;
+	std::chrono::seconds statsPeriod(0);
+	std::shared_ptr<const CompressionDictionary> dictionary;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if (arg == "-threaded")							threaded = true;
+		else if (arg == "-uring")						backend = IoBackend::uring;
+		else if (arg == "-validate")					validate = true;
+		else if (arg == "-no-utf8")						validateUtf8 = false;
+		else if (arg == "-strip")						strip = true;
+		else if (arg == "-presence" && i + 1 < argc)	presenceWindow = std::chrono::milliseconds(std::atoi(argv[++i]));
+		else if (arg == "-coalesce" && i + 1 < argc)	coalesce.budget = std::chrono::microseconds(std::atoi(argv[++i]));
+		else if (arg == "-max-bytes" && i + 1 < argc)	limits.maxBytes = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-max-frames" && i + 1 < argc)	limits.maxFrames = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-grace" && i + 1 < argc)		limits.grace = std::chrono::milliseconds(std::atoi(argv[++i]));
+		else if (arg == "-keep-messages")				limits.dropOldestMessages = false;
+		else if (arg == "-drop-presence")				limits.dropPresence = true;
+		else if (arg == "-stats" && i + 1 < argc)		statsPeriod = std::chrono::seconds(std::atoi(argv[++i]));
+		else if (arg == "-train" && i + 2 < argc)		return trainFromLog(argv[i + 1], argv[i + 2]);
+		else if (arg == "-dict" && i + 1 < argc)
+		{
+			auto d = std::make_shared<CompressionDictionary>();
+			if (d->loadFile(argv[++i]))
+				dictionary = d;
+			else
+				std::cout << "No compression, " << argv[i] << " holds no dictionary or zstd is missing" << std::endl;
+		}
+	}
+
+	if (InitWinSock())
+	{
+		if (threaded)
+		{
+			Server server;
+			server.setPresenceWindow(presenceWindow);
+			server.setValidateMessages(validate);
+			server.setValidateUtf8(validateUtf8);
+			server.setStripControls(strip);
+			server.setOutboundLimits(limits);
+			server.setDictionary(dictionary);
+			run(server, [&] {
+				if (statsPeriod.count() > 0)
+					std::thread(printThreadedStats, std::ref(server), statsPeriod).detach();
+			});
+		}
+		else
+		{
+			EventServer server;
+			server.setPresenceWindow(presenceWindow);
+			server.setValidateMessages(validate);
+			server.setValidateUtf8(validateUtf8);
+			server.setStripControls(strip);
+			server.setCoalescePolicy(coalesce);
+			server.setOutboundLimits(limits);
+			server.setDictionary(dictionary);
+			run(server, [&] {
+				if (statsPeriod.count() > 0)
+					std::thread(printWriteMetrics, std::ref(server), statsPeriod).detach();
+			}, backend);
 		}
 	}
 
@@ -0,0 +1,998 @@
+#pragma once
+
+#include "server.h"
+#include "poller.h"
+#include "uring.h"
+#include "outbound.h"
+#include "registry.h"
+#include "presence.h"
+#include "inbound.h"
+
+#include <unordered_map>
+
+#ifdef _WIN32
+constexpr int LOOP_TIMEOUT_MS = 1;		// WSAPoll can not be woken up, so loops poll for new work
+#else
+constexpr int LOOP_TIMEOUT_MS = -1;		// loops sleep until a socket is ready or wake() is called
+#endif
+
+class EventServer;
+
+// how event loops write to their sockets
+enum class IoBackend
+{
+	readiness,		// non-blocking send() when poller reports the socket writable (works everywhere)
+	uring			// batched gathered sends through io_uring, falls back to readiness if unavailable
+};
+
+// state of a connection handled by an event loop
+enum class ConnState
+{
+	handshake,		// server context queued, waiting for client context
+	active			// client context received, in message loop
+};
+
+// per connection state machine data
+struct Connection
+{
+	SOCKET socketID = INVALID_SOCKET;	// socket of this connection
+	User user;							// user of this connection (id is valid from handshake)
+	ConnState state = ConnState::handshake;
+
+	StreamBuffer inBuffer;				// received bytes not yet parsed into frames
+
+	OutboundQueue outQueue;				// encoded frames waiting to be written (shared with other connections for broadcasts)
+	bool writeInterest = false;			// true if poller is watching for write readiness
+	bool flushPending = false;			// frames queued this iteration, written once deliveries are drained
+	bool batching = false;				// client announced featureBatch, queued frames are packed into batch frames
+	std::unique_ptr<FrameCompressor> compressor;	// set if client announced featureCompression
+
+	WriteMode writeMode = WriteMode::immediate;			// how queued frames are written (chosen per flush)
+	bool holding = false;								// queued frames held back for coalescing
+	std::chrono::steady_clock::time_point holdUntil;	// when held frames are written at the latest
+
+#ifdef HAS_IO_URING
+	UringSend uringSend;				// send owned by the ring while sending is true
+	bool sending = false;				// true while a uring send is in flight
+	bool dirty = false;					// true if queued in pendingSends
+	bool closing = false;				// closed while a send was in flight, released on its completion
+#endif
+};
+
+// frame routed to a loop
+struct Delivery
+{
+	SOCKET socketID;		// target socket or INVALID_SOCKET for every active connection of the loop
+	unsigned int userID;	// user the frame is for (sockets are reused once a connection is closed)
+	SharedFrame frame;		// frame to queue (shared, not copied)
+	FrameClass type;		// how the frame may be evicted from a slow connection
+};
+
+// single threaded non-blocking loop that owns a set of connections
+class EventLoop
+{
+	EventServer* server;								// owning server (used for routing and registry)
+	Poller poller;										// readiness poller for owned sockets
+
+	std::thread* loopThread = nullptr;					// thread running this loop
+	std::atomic<bool> running;
+
+	std::unordered_map<SOCKET, Connection> connections;	// connections owned by this loop
+
+	MsgQueue<SOCKET> newSockets;						// accepted sockets to be adopted by this loop
+	MsgQueue<Delivery> deliveries;						// frames posted from any loop
+	std::vector<SOCKET> toFlush;						// connections with frames queued this iteration
+	std::vector<SOCKET> held;							// connections holding frames back for coalescing
+
+	BatchPacker packer;									// packs frames queued for batching connections
+	CompressedFrames compressed;						// frames compressed this iteration (broadcasts compressed once per loop)
+
+	float load = 0;										// share of time spent working instead of waiting (moving average)
+	WriteStats writeStats;								// write modes and sizes of this loop
+
+#ifdef HAS_IO_URING
+	Uring uring;										// ring used for writes when useUring is set
+	bool useUring = false;
+	std::vector<SOCKET> pendingSends;					// connections with data to submit this iteration
+
+	// gather queued frames of every pending connection and submit them with one syscall
+	void submitSends();
+
+	// consume finished sends and requeue connections with data left
+	void reapSends();
+
+	// wait for every send in flight to complete, so the ring no longer references connection buffers
+	void drainSends();
+#endif
+
+	// thread method running the loop
+	void run();
+
+	// take ownership of accepted socket and start handshake
+	void adopt(SOCKET _socketID);
+
+	// read everything available from a connection
+	// returns false if connection should be closed
+	bool onReadable(Connection& _conn);
+
+	// handle a complete information received from a connection
+	// returns false if connection should be closed
+	bool onInfo(Connection& _conn, std::string_view _info);
+
+	// route a frame by its routing header and forward it as received, without decoding the information
+	// _payload : payload of the frame (view into inBuffer, routing header included)
+	// returns false if connection should be closed
+	bool onRouted(Connection& _conn, std::string_view _payload);
+
+	// queue encoded frame for connection, written at the end of the loop iteration
+	// (so frames queued together go out together, packed into a batch if the client takes them)
+	// returns false if connection should be closed (slow consumer over its limits)
+	bool queueFrame(Connection& _conn, const SharedFrame& _frame, FrameClass _type);
+
+	// write queued frames now or hold them back, depending on the connection's coalescing mode
+	// _now : time of this loop iteration
+	// returns false if connection should be closed
+	bool write(Connection& _conn, std::chrono::steady_clock::time_point _now);
+
+	// write held frames whose time is up and wake the loop for the next deadline
+	void writeHeld(std::chrono::steady_clock::time_point _now);
+
+	// switch write mode of a connection
+	void setWriteMode(Connection& _conn, WriteMode _mode);
+
+	// pack and compress frames queued since the last write, as the client negotiated
+	void prepare(Connection& _conn);
+
+	// write as much pending data as the socket accepts
+	// returns false if connection should be closed
+	bool flush(Connection& _conn);
+
+	// unregister and close connection
+	void close(SOCKET _socketID);
+
+	// close socket and forget connection
+	void release(SOCKET _socketID);
+
+	// returns false if connection is closed and only waiting for an in flight send
+	static bool isOpen(const Connection& _conn)
+	{
+#ifdef HAS_IO_URING
+		return !_conn.closing;
+#else
+		return true;
+#endif
+	}
+
+public:
+	EventLoop(EventServer* _server) :server(_server) {
+		running = false;
+	}
+
+	// start loop thread
+	// _backend : how sockets are written
+	// returns true if started
+	bool start(IoBackend _backend)
+	{
+		if (!poller.create())
+			return false;
+
+		if (_backend == IoBackend::uring)
+		{
+#ifdef HAS_IO_URING
+			useUring = uring.create(1024) && poller.add(uring.fd(), pollRead);	// ring fd is readable when sends complete
+#endif
+			if (!usingUring())
+				std::cout << "io_uring not available, using readiness writes" << std::endl;
+		}
+
+		running = true;
+		loopThread = new std::thread(&EventLoop::run, this);
+		return true;
+	}
+
+	// hand over an accepted socket to this loop (thread safe)
+	void post(SOCKET _socketID)
+	{
+		newSockets.enqueue(_socketID);
+		poller.wake();
+	}
+
+	// deliver encoded frame to a socket owned by this loop (thread safe)
+	// _socketID : target socket or INVALID_SOCKET for every active connection of this loop
+	// _userID : user the frame is for (dropped if the socket now belongs to another connection, ignored for INVALID_SOCKET)
+	// _frame : frame to deliver (shared, not copied)
+	// _type : how the frame may be evicted from a slow connection
+	void deliver(SOCKET _socketID, unsigned int _userID, const SharedFrame& _frame, FrameClass _type)
+	{
+		deliveries.enqueue(Delivery{ _socketID, _userID, _frame, _type });
+		poller.wake();
+	}
+
+	// stop loop and close all owned connections
+	void stop()
+	{
+		if (loopThread == nullptr)
+			return;
+
+		running = false;
+		poller.wake();
+		loopThread->join();
+		delete loopThread;
+		loopThread = nullptr;
+
+#ifdef HAS_IO_URING
+		drainSends();									// ring may still write from queued frames
+		uring.destroy();
+#endif
+
+		for (auto& c : connections)
+			closesocket(c.first);
+		connections.clear();
+	}
+
+	// write modes and sizes of this loop
+	const WriteStats& getWriteStats() const {
+		return writeStats;
+	}
+
+	// returns true if this loop writes through io_uring
+	bool usingUring() const
+	{
+#ifdef HAS_IO_URING
+		return useUring;
+#else
+		return false;
+#endif
+	}
+
+	~EventLoop()
+	{
+		stop();
+	}
+};
+
+// server that handles connections on a fixed number of non-blocking event loops (one per core)
+// instead of one blocking thread per client
+class EventServer :public SocketBase
+{
+	// where a registered user lives
+	struct Endpoint
+	{
+		EventLoop* loop;	// loop owning the connection
+		SOCKET socketID;	// socket of the connection
+		User user;			// user data
+	};
+
+	std::vector<EventLoop*> loops;						// event loops (one per core)
+	size_t nextLoop = 0;								// round robin index for new connections
+
+	ShardedRegistry<Endpoint> clients;					// registered users by id (locks itself per shard)
+	Roster roster;										// versioned user list clients sync with
+	PresenceBatcher presence{ roster };					// broadcasts roster changes in batches
+
+	OutboundLimits limits;								// caps on data queued per connection
+	OutboundStats stats;								// how often overflow policies fired
+	CoalescePolicy coalesce;							// when loops hold writes back to merge them
+
+	InboundPolicy inbound;								// checks run on messages before they are routed
+	std::shared_ptr<const CompressionDictionary> dictionary;	// offered to clients for compression (none if null)
+
+	std::atomic<bool> running;
+public:
+	EventServer() {
+		running = false;
+	}
+
+	// bind server to given port
+	// return true if bind successful
+	bool bind(const unsigned int& port) {
+		return SocketBase::bindServer(port);
+	}
+
+	// set caps and overflow policies for data queued per connection (call before start)
+	void setOutboundLimits(const OutboundLimits& _limits) {
+		limits = _limits;
+	}
+
+	// caps and overflow policies for data queued per connection
+	const OutboundLimits& outboundLimits() const {
+		return limits;
+	}
+
+	// counters of overflow policies
+	OutboundStats& outboundStats() {
+		return stats;
+	}
+
+	// set when connections hold writes back to merge them (call before start)
+	void setCoalescePolicy(const CoalescePolicy& _policy) {
+		coalesce = _policy;
+	}
+
+	// when connections hold writes back to merge them
+	const CoalescePolicy& coalescePolicy() const {
+		return coalesce;
+	}
+
+	// write modes and sizes summed over event loops
+	WriteMetrics writeMetrics() const
+	{
+		WriteMetrics metrics;
+		for (auto l : loops)
+			metrics.add(l->getWriteStats());
+		return metrics;
+	}
+
+	// set how long joins and leaves are collected before broadcasting (call before start, zero for no batching)
+	void setPresenceWindow(std::chrono::milliseconds _window) {
+		presence.setWindow(_window);
+	}
+
+	// fully decode routed messages and check them against their routing header (call before start)
+	// off by default, routing reads only the routing header if no other check needs the text
+	void setValidateMessages(bool _validate) {
+		inbound.validateMessages = _validate;
+	}
+
+	// drop messages whose text is not valid UTF-8 (call before start, on by default)
+	void setValidateUtf8(bool _validate) {
+		inbound.validateUtf8 = _validate;
+	}
+
+	// remove control characters other than tab and new line from message text (call before start)
+	void setStripControls(bool _strip) {
+		inbound.stripControls = _strip;
+	}
+
+	// checks run on messages before they are routed
+	const InboundPolicy& inboundPolicy() const {
+		return inbound;
+	}
+
+	// offer frame compression with a trained dictionary to clients holding the same one (call before start)
+	void setDictionary(std::shared_ptr<const CompressionDictionary> _dictionary) {
+		dictionary = std::move(_dictionary);
+	}
+
+	// dictionary offered to clients (null if compression is off)
+	const std::shared_ptr<const CompressionDictionary>& compressionDictionary() const {
+		return dictionary;
+	}
+
+	// start server and its event loops
+	// _backend : how event loops write to sockets
+	// return true if successful
+	bool start(IoBackend _backend = IoBackend::readiness)
+	{
+		running = SocketBase::startServer();
+		if (!running)
+			return false;
+
+		unsigned int cores = std::thread::hardware_concurrency();
+		if (cores == 0)									// unknown core count
+			cores = 1;
+
+		for (unsigned int i = 0; i < cores; i++)
+		{
+			EventLoop* loop = new EventLoop(this);
+			if (!loop->start(_backend))
+			{
+				delete loop;
+				return running = false;
+			}
+			loops.push_back(loop);
+		}
+
+		presence.start([this](const std::string& _info) { route(0, _info); });
+
+		std::cout << "Started " << loops.size() << " event loops" << std::endl;
+		return true;
+	}
+
+	// accept client connection and hand it to an event loop
+	// return true if client connected
+	bool accept()
+	{
+		SOCKET sock;
+		std::string ip;
+
+		if (!SocketBase::acceptClient(sock, ip))
+			return false;
+
+		if (!setNonBlocking(sock))
+		{
+			std::cerr << "Failed to make socket " << sock << " non-blocking" << std::endl;
+			closesocket(sock);
+			return false;
+		}
+		setNoDelay(sock);
+
+		loops[nextLoop]->post(sock);
+		nextLoop = (nextLoop + 1) % loops.size();
+		return true;
+	}
+
+	// returns a list of users for server context
+	std::vector<User> getUsers()
+	{
+		std::vector<User> users;
+		clients.forEach([&](auto& c) { users.emplace_back(c.conn.user); });
+		return users;
+	}
+
+	// current roster version (sent in server context)
+	uint64_t rosterVersion() {
+		return roster.currentVersion();
+	}
+
+	// register user after handshake, broadcast join and sync the user's roster
+	// _known : roster version the client already has
+	void join(EventLoop* _loop, SOCKET _socketID, const User& _user, uint64_t _known)
+	{
+		clients.add(_user.id, _socketID, Endpoint{ _loop, _socketID, _user });
+
+		presence.join(_user);
+		syncRoster(_user.id, _known);
+		std::cout << _user.username << " Joined " << std::endl;
+	}
+
+	// unregister user and broadcast exit
+	void leave(const User& _user)
+	{
+		clients.removeById(_user.id);
+
+		presence.leave(_user);
+		std::cout << _user.username << " left." << std::endl;
+	}
+
+	// send roster changes since _known or snapshot pages to a user
+	// answers are delivered under the roster lock, so they are queued in order with presence broadcasts
+	void syncRoster(int _id, uint64_t _known)
+	{
+		roster.sync(_known, [&](const std::string& _info) { route(_id, _info); });
+	}
+
+	// route information to a user or everyone
+	// information is encoded once and the same frame is queued on every receiver
+	// _id : user id of receiver (0 for all)
+	// _info : information to send
+	void route(const int& _id, std::string_view _info)
+	{
+		route(_id, makeFrame(_info), classify(peekType(_info)));
+	}
+
+	// route an encoded frame to a user or everyone
+	// _id : user id of receiver (0 for all)
+	// _frame : frame to deliver (shared, not copied)
+	// _type : how the frame may be evicted from a slow connection
+	void route(const int& _id, const SharedFrame& _frame, FrameClass _type)
+	{
+		if (_id == 0)
+		{
+			for (auto l : loops)
+				l->deliver(INVALID_SOCKET, 0, _frame, _type);
+			return;
+		}
+
+		Endpoint receiver;
+		if (clients.findById(_id, receiver))				// shared lock on one shard
+			receiver.loop->deliver(receiver.socketID, receiver.user.id, _frame, _type);
+	}
+
+	~EventServer()
+	{
+		running = false;
+		presence.stop();
+
+		for (auto l : loops)	// stop and destroy all loops
+		{
+			l->stop();
+			delete l;
+		}
+
+		std::cout << "Server Cleaned" << std::endl;
+	}
+};
+
+inline void EventLoop::run()
+{
+	std::vector<PollResult> ready;
+	SOCKET sock;
+	Delivery delivery;
+
+	while (running)
+	{
+		auto waitStart = std::chrono::steady_clock::now();
+		poller.wait(ready, LOOP_TIMEOUT_MS);
+		auto workStart = std::chrono::steady_clock::now();
+
+#ifdef HAS_IO_URING
+		if (useUring)
+			reapSends();
+#endif
+
+		for (auto& r : ready)
+		{
+			auto c = connections.find(r.socketID);
+			if (c == connections.end())
+				continue;
+
+			bool keep = true;
+			if (r.events & (pollRead | pollClosed))
+				keep = onReadable(c->second);
+			if (keep && (r.events & pollWrite))
+				keep = flush(c->second);
+
+			if (!keep)
+				close(r.socketID);
+		}
+
+		while (newSockets.dequeue(sock))		// adopt new connections
+			adopt(sock);
+
+		while (deliveries.dequeue(delivery))	// queue routed information
+		{
+			if (delivery.socketID == INVALID_SOCKET)
+			{
+				std::vector<SOCKET> failed;
+				for (auto& c : connections)
+					if (isOpen(c.second) && c.second.state == ConnState::active && !queueFrame(c.second, delivery.frame, delivery.type))
+						failed.push_back(c.first);
+
+				for (auto s : failed)
+					close(s);
+				continue;
+			}
+
+			auto c = connections.find(delivery.socketID);
+			if (c == connections.end() || !isOpen(c->second))
+				continue;
+			if (c->second.user.id != delivery.userID || c->second.state != ConnState::active)	// user left, socket reused by a new connection
+				continue;
+			if (!queueFrame(c->second, delivery.frame, delivery.type))
+				close(delivery.socketID);
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		for (SOCKET s : toFlush)				// write everything queued with one send per connection (or hold it back)
+		{
+			auto c = connections.find(s);
+			if (c == connections.end() || !isOpen(c->second))
+				continue;
+
+			c->second.flushPending = false;
+			if (!write(c->second, now))
+				close(s);
+		}
+		toFlush.clear();
+
+		writeHeld(now);
+
+#ifdef HAS_IO_URING
+		if (useUring)
+			submitSends();
+#endif
+
+		compressed.clear();						// queued frames hold what they need
+
+		auto waited = (workStart - waitStart).count();
+		auto worked = (std::chrono::steady_clock::now() - workStart).count();
+		if (waited + worked > 0)
+			load += 0.1f * (float(worked) / float(waited + worked) - load);
+	}
+}
+
+inline void EventLoop::adopt(SOCKET _socketID)
+{
+	Connection& conn = connections[_socketID];
+	conn.socketID = _socketID;
+	conn.user.id = GenereateID();					// generate new unique id for this client
+
+	if (!poller.add(_socketID, pollRead))
+	{
+		std::cout << "Failed to watch socket " << _socketID << std::endl;
+		closesocket(_socketID);
+		connections.erase(_socketID);
+		return;
+	}
+
+	auto& dictionary = server->compressionDictionary();
+	ServerContext sc(conn.user.id, server->rosterVersion(), dictionary ? dictionary->id() : 0);	// create and send server context
+	if (!queueFrame(conn, makeFrame(sc.encode()), FrameClass::critical))
+	{
+		std::cout << "Server context not send" << std::endl;
+		close(_socketID);
+	}
+}
+
+inline bool EventLoop::onReadable(Connection& _conn)
+{
+	FrameHeader header;
+	std::string_view info;			// view into inBuffer, no copy per frame
+	bool corrupted;
+
+	while (true)
+	{
+		char* space = _conn.inBuffer.prepare(RECV_CHUNK_SIZE);
+		int bytes = recv(_conn.socketID, space, (int)_conn.inBuffer.space(), 0);
+		if (bytes <= 0)
+			return bytes < 0 && wouldBlock();
+
+		_conn.inBuffer.commit(bytes);
+
+		while (_conn.inBuffer.nextFrame(header, info, corrupted))	// handle every complete frame
+		{
+			if ((header.flags & frameCompressed) && (!_conn.compressor || !_conn.compressor->decompress(header, info)))
+			{
+				std::cout << "Corrupted compressed frame received from " << _conn.user.username << std::endl;
+				return false;
+			}
+
+			if (!(header.type == frameRouted ? onRouted(_conn, info) : onInfo(_conn, info)))
+				return false;
+		}
+
+		if (corrupted)
+		{
+			std::cout << "Corrupted frame received from " << _conn.user.username << std::endl;
+			return false;
+		}
+	}
+}
+
+inline bool EventLoop::onInfo(Connection& _conn, std::string_view _info)
+{
+	if (_conn.state == ConnState::handshake)
+	{
+		ClientContext cc;
+		if (!cc.decode(_info))
+		{
+			std::cout << "Client context is corrupted" << std::endl;
+			return false;
+		}
+
+		_conn.user.username = cc.username;
+		_conn.state = ConnState::active;
+		_conn.batching = (cc.features & featureBatch) != 0;
+		if ((cc.features & featureCompression) && server->compressionDictionary())
+			_conn.compressor = std::make_unique<FrameCompressor>(server->compressionDictionary());
+		server->join(this, _conn.socketID, _conn.user, cc.rosterVersion);
+		return true;
+	}
+
+	if (_info == NETWORK_EXIT)		// check for exit message
+		return false;
+
+	NetInfoView netInfo;						// views into inBuffer, nothing is copied
+	if (!netInfo.decode(_info))					// decode info
+	{
+		std::cout << "Corrupted info received from " << _conn.user.username << std::endl;
+		return true;
+	}
+
+	if (netInfo.type == NetInfoType::rosterRequest)
+	{
+		RosterRequest request;
+		if (request.decode(netInfo.data))
+			server->syncRoster(_conn.user.id, request.version);
+	}
+	else										// messages come routed, anything else is not for the server
+		std::cout << "Unexpected " << toString(netInfo.type) << " received from " << _conn.user.username << std::endl;
+
+	return true;
+}
+
+inline bool EventLoop::onRouted(Connection& _conn, std::string_view _payload)
+{
+	if (_conn.state != ConnState::active)		// client context must come first
+		return false;
+
+	RouteHeader route;
+	if (!route.read(_payload) || route.type != NetInfoType::message || route.from != uint32_t(_conn.user.id))
+	{
+		std::cout << "Corrupted routing header received from " << _conn.user.username << std::endl;
+		return true;
+	}
+
+	SharedFrame frame;
+	if (!acceptRouted(server->inboundPolicy(), route, _payload, frame))
+	{
+		std::cout << "Rejected message from " << _conn.user.username << std::endl;
+		return true;
+	}
+
+	server->route(int(route.to), frame, FrameClass::chat);
+	return true;
+}
+
+inline bool EventLoop::queueFrame(Connection& _conn, const SharedFrame& _frame, FrameClass _type)
+{
+	if (!_conn.outQueue.push(_frame, _type, server->outboundLimits(), server->outboundStats()))
+	{
+		std::cout << "Disconnecting slow consumer " << _conn.user.username << " (" << _conn.outQueue.byteSize() << " bytes queued)" << std::endl;
+		return false;
+	}
+
+	if (!_conn.flushPending)
+	{
+		_conn.flushPending = true;
+		toFlush.push_back(_conn.socketID);
+	}
+	return true;
+}
+
+inline bool EventLoop::write(Connection& _conn, std::chrono::steady_clock::time_point _now)
+{
+	const CoalescePolicy& policy = server->coalescePolicy();
+
+	bool deep = _conn.outQueue.size() >= policy.deepFrames;
+	bool coalesce = policy.budget.count() > 0 && (deep || load >= policy.busyLoad);
+	setWriteMode(_conn, coalesce ? WriteMode::coalescing : WriteMode::immediate);
+
+	if (!coalesce || _conn.outQueue.byteSize() >= policy.holdBytes || (_conn.holding && _now >= _conn.holdUntil))
+		return flush(_conn);
+
+	if (!_conn.holding)							// hold back, frames queued until the deadline join the same write
+	{
+		_conn.holding = true;
+		_conn.holdUntil = _now + policy.budget;
+		held.push_back(_conn.socketID);
+	}
+	return true;
+}
+
+inline void EventLoop::writeHeld(std::chrono::steady_clock::time_point _now)
+{
+	auto next = std::chrono::steady_clock::time_point::max();
+
+	size_t kept = 0;
+	for (SOCKET s : held)
+	{
+		auto c = connections.find(s);
+		if (c == connections.end() || !isOpen(c->second) || !c->second.holding)	// closed or written meanwhile
+			continue;
+
+		if (_now < c->second.holdUntil)
+		{
+			if (c->second.holdUntil < next)
+				next = c->second.holdUntil;
+			held[kept++] = s;
+			continue;
+		}
+
+		if (!flush(c->second))
+			close(s);
+	}
+	held.resize(kept);
+
+	if (!held.empty())
+		poller.wakeAfter(std::chrono::duration_cast<std::chrono::microseconds>(next - _now));
+}
+
+inline void EventLoop::setWriteMode(Connection& _conn, WriteMode _mode)
+{
+	if (_conn.writeMode == _mode)
+		return;
+
+	_conn.writeMode = _mode;
+	uint64_t count = writeStats.coalescingConnections.load(std::memory_order_relaxed);
+	writeStats.coalescingConnections.store(_mode == WriteMode::coalescing ? count + 1 : count - 1, std::memory_order_relaxed);
+}
+
+inline void EventLoop::prepare(Connection& _conn)
+{
+	if (!_conn.batching && !_conn.compressor)
+		return;
+
+	_conn.outQueue.prepare(_conn.batching ? &packer : nullptr, _conn.compressor.get(), &compressed);
+	server->outboundStats().addBatches(packer);
+	if (_conn.compressor)
+		server->outboundStats().addCompression(*_conn.compressor);
+}
+
+inline bool EventLoop::flush(Connection& _conn)
+{
+	_conn.holding = false;						// everything queued goes out now
+
+#ifdef HAS_IO_URING
+	if (useUring)		// write is gathered and submitted at the end of this iteration
+	{
+		if (!_conn.sending && !_conn.dirty && !_conn.outQueue.empty())
+		{
+			_conn.dirty = true;
+			pendingSends.push_back(_conn.socketID);
+		}
+
+		if (_conn.writeInterest)	// socket drained, the ring takes over until the next EAGAIN
+			_conn.writeInterest = !poller.modify(_conn.socketID, pollRead);
+		return true;
+	}
+#endif
+
+	prepare(_conn);
+
+	// coalesced frames needing several sends are corked, so segments are filled across sends
+	bool cork = _conn.writeMode == WriteMode::coalescing && _conn.outQueue.size() > MAX_SEND_BUFFERS && setCork(_conn.socketID, true);
+
+	bool ok = true;
+	std::string_view buffers[MAX_SEND_BUFFERS];
+	while (!_conn.outQueue.empty())
+	{
+		size_t count = _conn.outQueue.gather(buffers, MAX_SEND_BUFFERS);	// every queued frame in one vectored send
+		int bytes = sendBuffers(_conn.socketID, buffers, count);
+
+		if (bytes == SOCKET_ERROR)
+		{
+			ok = wouldBlock();
+			if (ok && !_conn.writeInterest)		// wait for socket to drain
+				_conn.writeInterest = poller.modify(_conn.socketID, pollRead | pollWrite);
+			break;
+		}
+
+		writeStats.record(_conn.outQueue.infos(count), _conn.writeMode);
+		_conn.outQueue.consume(bytes);
+	}
+
+	if (cork)									// push out the last partial segment
+		setCork(_conn.socketID, false);
+
+	if (_conn.outQueue.empty() && _conn.writeInterest)	// nothing left, stop watching write readiness
+		_conn.writeInterest = !poller.modify(_conn.socketID, pollRead);
+
+	return ok;
+}
+
+inline void EventLoop::close(SOCKET _socketID)
+{
+	auto c = connections.find(_socketID);
+	if (c == connections.end() || !isOpen(c->second))
+		return;
+
+	poller.remove(_socketID);
+
+	if (c->second.state == ConnState::active)
+		server->leave(c->second.user);
+
+#ifdef HAS_IO_URING
+	if (c->second.sending)		// ring still uses this socket and its buffers, release on completion
+	{
+		c->second.closing = true;
+		return;
+	}
+#endif
+
+	release(_socketID);
+}
+
+inline void EventLoop::release(SOCKET _socketID)
+{
+	auto c = connections.find(_socketID);
+	if (c != connections.end())
+		setWriteMode(c->second, WriteMode::immediate);		// leave the coalescing count
+
+	closesocket(_socketID);
+	connections.erase(_socketID);
+}
+
+#ifdef HAS_IO_URING
+inline void EventLoop::submitSends()
+{
+	std::vector<SOCKET> retry;								// connections whose send could not be prepared
+	for (SOCKET sock : pendingSends)
+	{
+		auto c = connections.find(sock);
+		if (c == connections.end())
+			continue;
+
+		Connection& conn = c->second;
+		conn.dirty = false;
+		if (!isOpen(conn) || conn.sending || conn.outQueue.empty())
+			continue;
+
+		prepare(conn);
+
+		std::string_view buffers[MAX_SEND_BUFFERS];			// gather queued frames into one send
+		int count = (int)conn.outQueue.gather(buffers, MAX_SEND_BUFFERS);
+		conn.outQueue.pin(count);							// ring references these frames until completion
+		for (int i = 0; i < count; i++)
+		{
+			conn.uringSend.iov[i].iov_base = (void*)buffers[i].data();
+			conn.uringSend.iov[i].iov_len = buffers[i].size();
+		}
+
+		bool queued = uring.prepSend(sock, conn.uringSend, count, (uint64_t)sock);
+		while (!queued && uring.submit() >= 0)				// submission queue full, push what we have
+			queued = uring.prepSend(sock, conn.uringSend, count, (uint64_t)sock);
+
+		if (!queued)										// ring refused it, frames stay queued for the next iteration
+		{
+			conn.outQueue.pin(0);
+			conn.dirty = true;
+			retry.push_back(sock);
+			continue;
+		}
+
+		writeStats.record(conn.outQueue.infos(count), conn.writeMode);
+		conn.sending = true;
+	}
+
+	pendingSends.swap(retry);
+
+	bool failed = uring.submit() < 0;						// prepared entries stay in the ring and go with the next submit
+	if (failed)
+		std::cerr << "io_uring submit failed with error: " << errno << std::endl;
+	if (failed || !pendingSends.empty())					// retry on next iteration instead of sleeping
+		poller.wake();
+}
+
+inline void EventLoop::reapSends()
+{
+	uint64_t user;
+	int result;
+	while (uring.peek(user, result))
+	{
+		SOCKET sock = (SOCKET)user;
+		auto c = connections.find(sock);
+		if (c == connections.end())
+			continue;
+
+		Connection& conn = c->second;
+		conn.sending = false;
+		conn.outQueue.pin(0);
+
+		if (conn.closing)
+		{
+			release(sock);
+			continue;
+		}
+
+		if (result == -EAGAIN)			// socket buffer full, wait for write readiness and resubmit
+		{
+			if (!conn.writeInterest)
+				conn.writeInterest = poller.modify(sock, pollRead | pollWrite);
+			continue;
+		}
+
+		if (result < 0)
+		{
+			close(sock);
+			continue;
+		}
+
+		conn.outQueue.consume(result);	// drop fully sent frames
+
+		if (conn.outQueue.empty() && conn.writeInterest)
+			conn.writeInterest = !poller.modify(sock, pollRead);
+
+		flush(conn);					// requeue if anything is left
+	}
+}
+
+inline void EventLoop::drainSends()
+{
+	size_t inFlight = 0;
+	for (auto& c : connections)
+		if (c.second.sending)
+		{
+			shutdown(c.first, SD_BOTH);		// a send waiting for socket space fails at once
+			inFlight++;
+		}
+
+	uint64_t user;
+	int result;
+	while (inFlight > 0 && uring.wait())
+		while (uring.peek(user, result))
+		{
+			auto c = connections.find((SOCKET)user);
+			if (c == connections.end() || !c->second.sending)
+				continue;
+
+			c->second.sending = false;
+			c->second.outQueue.pin(0);
+			inFlight--;
+		}
+
+	if (inFlight > 0)
+		std::cerr << "io_uring wait failed with error: " << errno << ", " << inFlight << " sends still in flight" << std::endl;
+}
+#endif
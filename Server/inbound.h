@@ -0,0 +1,319 @@
+#pragma once
+
+#include "../Client/Networking.h"
+#include "../Client/NetworkData.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define INBOUND_SIMD								// SSE2 is part of x86-64, SSSE3 is checked at runtime
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSSE3								// msvc allows any intrinsic without /arch
+#else
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#endif
+
+// what the server checks in a message before routing it
+struct InboundPolicy
+{
+	bool validateMessages = false;		// decode routed messages and check them against their routing header
+	bool validateUtf8 = true;			// drop messages whose text is not valid UTF-8
+	bool stripControls = false;			// remove control characters (except tab and new line) from message text
+
+	// returns true if messages must be decoded to apply this policy
+	bool decodes() const {
+		return validateMessages || validateUtf8 || stripControls;
+	}
+};
+
+// returns length of the UTF-8 sequence starting at _in[_i], 0 if it is malformed, truncated, overlong or a surrogate
+static size_t utf8Sequence(const unsigned char* _in, size_t _size, size_t _i)
+{
+	unsigned char c = _in[_i];
+	if (c < 0x80)
+		return 1;
+
+	size_t length = c < 0xC2 ? 0 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF5 ? 4 : 0;
+	if (length == 0 || _i + length > _size)
+		return 0;
+
+	unsigned char c1 = _in[_i + 1];
+	if ((c == 0xE0 && c1 < 0xA0) || (c == 0xED && c1 > 0x9F) ||	// overlong 3 byte, surrogate
+		(c == 0xF0 && c1 < 0x90) || (c == 0xF4 && c1 > 0x8F))		// overlong 4 byte, above U+10FFFF
+		return 0;
+
+	for (size_t k = 1; k < length; k++)
+		if ((_in[_i + k] & 0xC0) != 0x80)
+			return 0;
+	return length;
+}
+
+// validate from _i one sequence at a time
+// returns position after the first whole sequence ending at or past _end, or _size + 1 if malformed
+static size_t validUtf8Scalar(const unsigned char* _in, size_t _size, size_t _i, size_t _end)
+{
+	while (_i < _end)
+	{
+		size_t length = utf8Sequence(_in, _size, _i);
+		if (length == 0)
+			return _size + 1;
+		_i += length;
+	}
+	return _i;
+}
+
+#ifdef INBOUND_SIMD
+// lookup validator after Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte" (2021)
+// three 16 entry tables classify each byte pair by high nibble of the first, low nibble of the first and high
+// nibble of the second byte, anding them leaves a bit set only for an invalid pair, then a carry check makes
+// sure 3rd and 4th bytes of long sequences are continuations and nothing else is
+namespace utf8lookup
+{
+	constexpr uint8_t TOO_SHORT = 1 << 0;		// lead byte not followed by a continuation
+	constexpr uint8_t TOO_LONG = 1 << 1;		// continuation after ascii
+	constexpr uint8_t OVERLONG_3 = 1 << 2;		// E0 followed by 80..9F
+	constexpr uint8_t TOO_LARGE = 1 << 3;		// above U+10FFFF
+	constexpr uint8_t SURROGATE = 1 << 4;		// ED followed by A0..BF
+	constexpr uint8_t OVERLONG_2 = 1 << 5;		// C0 or C1 lead
+	constexpr uint8_t TOO_LARGE_1000 = 1 << 6;	// F5.. followed by 80..8F
+	constexpr uint8_t OVERLONG_4 = 1 << 6;		// F0 followed by 80..8F
+	constexpr uint8_t TWO_CONTS = 1 << 7;		// continuation after continuation (checked by carry)
+	constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+	// returns previous byte _n places back, taking the end of _prev for the first ones
+	template<int N>
+	TARGET_SSSE3 static inline __m128i prev(__m128i _input, __m128i _prev) {
+		return _mm_alignr_epi8(_input, _prev, 16 - N);
+	}
+
+	// returns error bits of a block that is not all ascii
+	TARGET_SSSE3 static inline __m128i check(__m128i _input, __m128i _prev)
+	{
+		const __m128i byte1High = _mm_setr_epi8(
+			TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+			TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+			TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+			(char)(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4));
+		const __m128i byte1Low = _mm_setr_epi8(
+			CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+			CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000);
+		const __m128i byte2High = _mm_setr_epi8(
+			TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+			(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+			(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+			(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+			(char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+			TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+
+		__m128i prev1 = prev<1>(_input, _prev);
+		__m128i special = _mm_and_si128(
+			_mm_and_si128(_mm_shuffle_epi8(byte1High, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+				_mm_shuffle_epi8(byte1Low, _mm_and_si128(prev1, nibble))),
+			_mm_shuffle_epi8(byte2High, _mm_and_si128(_mm_srli_epi16(_input, 4), nibble)));
+
+		// 3rd and 4th bytes of a sequence must be continuations (only 111_____ two back or 1111____ three back reach 0x80)
+		__m128i third = _mm_subs_epu8(prev<2>(_input, _prev), _mm_set1_epi8(0xE0 - 0x80));
+		__m128i fourth = _mm_subs_epu8(prev<3>(_input, _prev), _mm_set1_epi8((char)(0xF0 - 0x80)));
+		__m128i must = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+		return _mm_xor_si128(must, special);
+	}
+
+	// returns non zero bytes if a block ends inside a sequence
+	TARGET_SSSE3 static inline __m128i incomplete(__m128i _input)
+	{
+		const __m128i limit = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			(char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+		return _mm_subs_epu8(_input, limit);
+	}
+
+	// validate 16 bytes at a time, the tail is copied into a zero padded block
+	TARGET_SSSE3 static bool validate(const unsigned char* _in, size_t _size)
+	{
+		__m128i error = _mm_setzero_si128();
+		__m128i prevInput = _mm_setzero_si128();
+		__m128i prevIncomplete = _mm_setzero_si128();
+
+		unsigned char tail[16] = {};
+		for (size_t i = 0; i < _size; i += 16)
+		{
+			const unsigned char* block = _in + i;
+			if (_size - i < 16)
+			{
+				std::memcpy(tail, block, _size - i);
+				block = tail;
+			}
+
+			__m128i input = _mm_loadu_si128((const __m128i*)block);
+			if (_mm_movemask_epi8(input) == 0)			// all ascii, only a sequence left open by the last block can be wrong
+				error = _mm_or_si128(error, prevIncomplete);
+			else
+			{
+				error = _mm_or_si128(error, check(input, prevInput));
+				prevIncomplete = incomplete(input);
+			}
+			prevInput = input;
+		}
+
+		error = _mm_or_si128(error, prevIncomplete);
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+	}
+}
+
+// returns true if the cpu has SSSE3 (checked once)
+static bool hasSsse3()
+{
+#ifdef _MSC_VER
+	static const bool has = [] { int info[4]; __cpuid(info, 1); return (info[2] & (1 << 9)) != 0; }();
+#else
+	static const bool has = __builtin_cpu_supports("ssse3");
+#endif
+	return has;
+}
+#endif
+
+// returns true if _text is valid UTF-8 (no overlong forms, surrogates or code points above U+10FFFF)
+// SSSE3 lookup validator where the cpu has it, otherwise ascii runs are skipped 16 bytes at a time with SSE2
+static bool validUtf8(std::string_view _text)
+{
+	const unsigned char* in = (const unsigned char*)_text.data();
+	size_t size = _text.size();
+
+#ifdef INBOUND_SIMD
+	if (size >= 16 && hasSsse3())
+		return utf8lookup::validate(in, size);
+
+	size_t i = 0;
+	while (i + 16 <= size)
+	{
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(in + i))) == 0)
+			i += 16;
+		else if ((i = validUtf8Scalar(in, size, i, i + 16)) > size)
+			return false;
+	}
+	return validUtf8Scalar(in, size, i, size) <= size;
+#else
+	return validUtf8Scalar(in, size, 0, size) <= size;
+#endif
+}
+
+// returns true if _text holds a control character other than tab and new line (C0, DEL or C1 U+0080..U+009F)
+// (_text must be valid UTF-8)
+static bool hasControls(std::string_view _text)
+{
+	const unsigned char* in = (const unsigned char*)_text.data();
+	size_t size = _text.size();
+	size_t i = 0;
+
+#ifdef INBOUND_SIMD
+	const __m128i low = _mm_set1_epi8(0x1F);
+	const __m128i del = _mm_set1_epi8(0x7F);
+	const __m128i c1Lead = _mm_set1_epi8((char)0xC2);
+	for (; i + 16 <= size; i += 16)		// blocks without a byte <= 0x1F, 0x7F or C2 need no closer look
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i hit = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(block, low), low),
+			_mm_or_si128(_mm_cmpeq_epi8(block, del), _mm_cmpeq_epi8(block, c1Lead)));
+		if (_mm_movemask_epi8(hit) != 0)
+			break;
+	}
+#endif
+
+	for (; i < size; i++)
+	{
+		unsigned char c = in[i];
+		if ((c < 0x20 && c != '\t' && c != '\n') || c == 0x7F || (c == 0xC2 && i + 1 < size && in[i + 1] < 0xA0))
+			return true;
+	}
+	return false;
+}
+
+// returns _text without control characters other than tab and new line (_text must be valid UTF-8)
+static std::string stripControls(std::string_view _text)
+{
+	std::string out;
+	out.reserve(_text.size());
+
+	for (size_t i = 0; i < _text.size(); i++)
+	{
+		unsigned char c = (unsigned char)_text[i];
+		if ((c < 0x20 && c != '\t' && c != '\n') || c == 0x7F)
+			continue;
+		if (c == 0xC2 && i + 1 < _text.size() && (unsigned char)_text[i + 1] < 0xA0)
+		{
+			i++;						// C1 control is two bytes
+			continue;
+		}
+		out += char(c);
+	}
+	return out;
+}
+
+// apply the text checks of a policy to an inbound message
+// _policy : checks to run
+// _text : text of the message
+// _clean : set to the text without control characters if any had to be stripped
+// _changed : set to true if _clean holds the text to route
+// returns false if the message must be dropped
+static bool checkText(const InboundPolicy& _policy, std::string_view _text, std::string& _clean, bool& _changed)
+{
+	_changed = false;
+	if ((_policy.validateUtf8 || _policy.stripControls) && !validUtf8(_text))
+		return false;
+
+	if (_policy.stripControls && hasControls(_text))
+	{
+		_clean = stripControls(_text);
+		_changed = true;
+	}
+	return true;
+}
+
+// decode a routed message and apply the inbound policy
+// nothing is decoded if the policy needs no checks, the frame is then routed by its routing header alone
+// _policy : checks to run
+// _route : routing header read from the frame
+// _payload : payload of the frame (routing header included, view into the receive buffer)
+// _out : frame to route, a copy of the received bytes or a re-encoded frame if text was stripped
+// returns false if the message must be dropped
+static bool acceptRouted(const InboundPolicy& _policy, const RouteHeader& _route, std::string_view _payload, SharedFrame& _out)
+{
+	if (_policy.decodes())
+	{
+		NetInfoView info;
+		MessageView msg;
+		if (!info.decode(_payload.substr(ROUTE_HEADER_SIZE)) || info.type != _route.type || !msg.decode(info.data) ||
+			msg.from != int(_route.from) || msg.to != int(_route.to))
+			return false;
+
+		std::string clean;
+		bool changed;
+		if (!checkText(_policy, msg.data, clean, changed))
+			return false;
+
+		if (changed)						// rare, re-encode with the cleaned text
+		{
+			std::string body, encoded;
+			MessageView(msg.from, msg.to, clean).encode(body);
+			NetInfoView(NetInfoType::message, body).encode(encoded);
+
+			auto frame = std::make_shared<std::string>();
+			encodeRoutedFrame(*frame, _route, encoded);
+			_out = std::move(frame);
+			return true;
+		}
+	}
+
+	_out = std::make_shared<const std::string>(frameOf(_payload));
+	return true;
+}
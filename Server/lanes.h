@@ -0,0 +1,159 @@
+#pragma once
+
+#include "../Client/MessageQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+constexpr size_t LATENCY_BUCKETS = 24;		// bucket i counts waits below 2^i microseconds, last one collects the rest
+
+// depth and queueing delay of one lane
+struct LaneStats
+{
+	std::atomic<uint64_t> depth;							// items waiting
+	std::atomic<uint64_t> dequeued;							// items taken
+	std::atomic<uint64_t> totalWaitUs;						// sum of waits of taken items
+	std::atomic<uint64_t> maxWaitUs;						// longest wait of a taken item
+	std::atomic<uint64_t> waitHistogram[LATENCY_BUCKETS];	// taken items by wait (log2 microseconds)
+
+	LaneStats() {
+		depth = dequeued = totalWaitUs = maxWaitUs = 0;
+		for (auto& b : waitHistogram)
+			b = 0;
+	}
+
+	// count a taken item that waited _us microseconds (consumer thread only)
+	void record(uint64_t _us)
+	{
+		depth--;
+		dequeued++;
+		totalWaitUs += _us;
+		if (_us > maxWaitUs)
+			maxWaitUs = _us;
+
+		size_t bucket = 0;
+		while (bucket < LATENCY_BUCKETS - 1 && (uint64_t(1) << bucket) <= _us)
+			bucket++;
+		waitHistogram[bucket]++;
+	}
+
+	// returns average wait in microseconds
+	double averageWaitUs() const
+	{
+		uint64_t count = dequeued;
+		return count > 0 ? double(totalWaitUs) / count : 0.0;
+	}
+
+	// returns upper bound in microseconds of the wait below which _fraction of taken items fall (eg 0.99)
+	uint64_t percentileWaitUs(double _fraction) const
+	{
+		uint64_t count = dequeued;
+		uint64_t seen = 0;
+		for (size_t i = 0; i < LATENCY_BUCKETS - 1; i++)
+		{
+			seen += waitHistogram[i];
+			if (seen >= count * _fraction)
+				return uint64_t(1) << i;
+		}
+		return maxWaitUs;
+	}
+};
+
+// multi producer / single consumer queue split into lanes drained by weighted round robin
+// each turn a lane may give up to its weight in items before the next lane is served,
+// so a busy lane can delay others by at most its weight and every lane with a weight is served
+template<typename T, size_t LANES>
+class LaneQueue
+{
+	struct Item
+	{
+		T data;
+		std::chrono::steady_clock::time_point queued;	// when item entered its lane
+	};
+
+	MsgQueue<Item> lanes[LANES];
+	LaneStats stats[LANES];
+	unsigned weights[LANES];				// items a lane may give per turn
+
+	QueueWaiter waiter;						// blocks consumer while every lane is empty
+
+	size_t lane = 0;						// lane being served (consumer only)
+	unsigned credit = 0;					// items it may still give this turn (consumer only)
+
+	// returns true if any lane has an item (consumer thread only)
+	bool any()
+	{
+		for (auto& l : lanes)
+			if (!l.isNull())
+				return true;
+		return false;
+	}
+
+public:
+	LaneQueue() {
+		for (auto& w : weights)
+			w = 1;
+	}
+
+	// set how many items a lane may give per turn (call before use, at least 1)
+	void setWeight(size_t _lane, unsigned _weight) {
+		weights[_lane] = _weight > 0 ? _weight : 1;
+	}
+
+	// depth and latency counters of a lane
+	const LaneStats& getStats(size_t _lane) const {
+		return stats[_lane];
+	}
+
+	// move item into a lane (safe from any thread)
+	void enqueue(size_t _lane, T&& _data)
+	{
+		stats[_lane].depth++;
+		lanes[_lane].enqueue(Item{ std::move(_data), std::chrono::steady_clock::now() });
+		waiter.notify();
+	}
+
+	// build item from arguments and move it into a lane (safe from any thread)
+	template<typename... Args>
+	void emplace(size_t _lane, Args&&... _args) {
+		enqueue(_lane, T(std::forward<Args>(_args)...));
+	}
+
+	// take next item by weighted round robin (consumer thread only)
+	// returns false if every lane is empty
+	bool dequeue(T& i)
+	{
+		Item item;
+		for (size_t turns = 0; turns <= LANES;)
+		{
+			if (credit > 0 && lanes[lane].dequeue(item))
+			{
+				credit--;
+				auto waited = std::chrono::steady_clock::now() - item.queued;
+				stats[lane].record(std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+				i = std::move(item.data);
+				return true;
+			}
+
+			// lane is empty or used its turn, serve next one
+			lane = (lane + 1) % LANES;
+			credit = weights[lane];
+			turns++;
+		}
+
+		return false;
+	}
+
+	// block until an item is available and take it (consumer thread only)
+	// returns false if queue is closed and empty
+	bool waitDequeue(T& i) {
+		return waiter.wait([this] { return any(); }, nullptr) && dequeue(i);
+	}
+
+	// stop blocking, waits return as soon as every lane is empty
+	void close() {
+		waiter.close();
+	}
+};
@@ -0,0 +1,528 @@
+#pragma once
+
+#include "../Client/Networking.h"
+#include "../Client/NetworkData.h"
+#include "../Client/Compression.h"
+
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// how a queued frame may be treated when its connection is over its outbound limits
+enum class FrameClass
+{
+	critical,		// handshake and anything unknown, never dropped
+	presence,		// clientJoined / clientLeft, dropped only if dropPresence is set
+	chat			// messages, oldest dropped first if dropOldestMessages is set
+};
+
+// returns how a frame carrying given information type may be treated
+static FrameClass classify(NetInfoType _type)
+{
+	switch (_type)
+	{
+	case message:		return FrameClass::chat;
+	case clientJoined:
+	case clientLeft:	return FrameClass::presence;
+	default:			return FrameClass::critical;
+	}
+}
+
+constexpr size_t MAX_BATCH_BYTES = 64 * 1024;	// max bytes of informations packed into one batch frame
+
+// returns information carried by an encoded frame (routing header skipped)
+// or an empty view if the frame can not go into a batch (not an information, compressed or already a batch)
+static std::string_view batchableInfo(const std::string& _frame)
+{
+	FrameHeader header;
+	if (_frame.size() < FRAME_HEADER_SIZE || !header.read(_frame.data()) || (header.flags & frameCompressed))
+		return std::string_view();
+
+	std::string_view info(_frame.data() + FRAME_HEADER_SIZE, _frame.size() - FRAME_HEADER_SIZE);
+	if (header.type == frameRouted && info.size() >= ROUTE_HEADER_SIZE)
+		info.remove_prefix(ROUTE_HEADER_SIZE);
+	else if (header.type != frameInfo)
+		return std::string_view();
+
+	NetInfoType type = peekType(info);
+	return type == NetInfoType::Null || type == NetInfoType::batch ? std::string_view() : info;
+}
+
+// encode informations into one frame holding a batch info
+// written in one pass, the bytes are those of NetInfo(batch, InfoBatchView{ _infos }) framed
+// (fields are written the way the schema codec writes them, so both stay in step)
+static SharedFrame makeBatchFrame(const std::vector<std::string_view>& _infos)
+{
+	constexpr uint64_t type = toWire(NetInfoType::batch);
+
+	size_t dataSize = varintSize(_infos.size());
+	for (auto& i : _infos)
+		dataSize += varintSize(i.size()) + i.size();
+
+	auto frame = std::make_shared<std::string>();
+	frame->reserve(FRAME_HEADER_SIZE + varintSize(type) + varintSize(dataSize) + dataSize);
+	frame->resize(FRAME_HEADER_SIZE);
+
+	putVarint(*frame, type);					// NetInfo type
+	putVarint(*frame, dataSize);				// NetInfo data length
+	putVarint(*frame, _infos.size());			// InfoBatchView infos
+	for (auto& i : _infos)
+		putBytes(*frame, i);
+
+	FrameHeader header;
+	header.length = uint32_t(frame->size() - FRAME_HEADER_SIZE);
+	header.write(&(*frame)[0]);
+	return frame;
+}
+
+// packs runs of consecutive informations queued for one connection into batch frames
+// frames are passed in send order and handed back in the same order through an emit callback,
+// a run of one is handed back as it was, frames that can not be batched end the current run
+class BatchPacker
+{
+	std::vector<SharedFrame> run;			// frames of current run (keep infos alive)
+	std::vector<std::string_view> infos;	// informations of current run
+	size_t bytes = 0;						// bytes of informations in current run
+	FrameClass runType = FrameClass::chat;	// class of current run (most protected class of its frames)
+
+	// hand back current run as a batch frame (or its only frame)
+	template<typename Emit>
+	void emitRun(Emit& _emit)
+	{
+		if (run.size() == 1)
+			_emit(run.front(), runType, size_t(1));
+		else if (run.size() > 1)
+		{
+			_emit(makeBatchFrame(infos), runType, run.size());
+			batches++;
+			packed += run.size();
+		}
+
+		run.clear();
+		infos.clear();
+		bytes = 0;
+		runType = FrameClass::chat;
+	}
+
+public:
+	uint64_t batches = 0;		// batch frames made
+	uint64_t packed = 0;		// informations packed into them
+
+	// add next frame
+	// _type : eviction class of the frame (a batch gets the most protected class of what it holds)
+	// _emit : called with (frame, class, informations in it) for every frame ready to be sent
+	template<typename Emit>
+	void add(const SharedFrame& _frame, FrameClass _type, Emit& _emit)
+	{
+		std::string_view info = batchableInfo(*_frame);
+		if (info.empty())
+		{
+			emitRun(_emit);
+			_emit(_frame, _type, size_t(1));
+			return;
+		}
+
+		if (!run.empty() && bytes + info.size() > MAX_BATCH_BYTES)
+			emitRun(_emit);
+
+		run.push_back(_frame);
+		infos.push_back(info);
+		bytes += info.size();
+		if (_type < runType)
+			runType = _type;
+	}
+
+	// hand back what is left of the current run
+	template<typename Emit>
+	void finish(Emit& _emit)
+	{
+		emitRun(_emit);
+	}
+};
+
+// frames compressed since the last clear, so a frame queued on many connections is compressed once
+// (every connection compresses with the same dictionary and settings, so the result is the same for all)
+// not thread safe, owner must serialize access
+class CompressedFrames
+{
+	std::unordered_map<const std::string*, std::pair<SharedFrame, SharedFrame>> frames;	// raw frame -> (raw frame kept alive, frame to send)
+
+public:
+	// returns _frame compressed with _compressor (or _frame itself if it is sent raw)
+	SharedFrame compress(const SharedFrame& _frame, FrameCompressor& _compressor)
+	{
+		auto& entry = frames[_frame.get()];
+		if (!entry.first)
+		{
+			entry.first = _frame;
+			entry.second = _compressor.compress(_frame);
+		}
+		else if (entry.second != entry.first)		// counted as if this connection compressed it
+		{
+			_compressor.frames++;
+			_compressor.rawBytes += _frame->size();
+			_compressor.compressedBytes += entry.second->size();
+		}
+		return entry.second;
+	}
+
+	// forget compressed frames (raw frames are no longer pinned by the cache)
+	void clear()
+	{
+		frames.clear();
+	}
+};
+
+// per connection caps on data waiting to be written and what to do when a reader can not keep up
+struct OutboundLimits
+{
+	size_t maxBytes = 4 * 1024 * 1024;		// max unsent bytes queued for one connection
+	size_t maxFrames = 8192;				// max frames queued for one connection
+
+	bool dropOldestMessages = true;			// evict oldest chat messages to make room
+	bool dropPresence = false;				// evict oldest presence events to make room (receiver's user list goes stale)
+
+	std::chrono::milliseconds grace = std::chrono::milliseconds(5000);	// disconnect if still over limits after this long
+};
+
+// how often each overflow policy fired (shared by all connections of a server)
+struct OutboundStats
+{
+	std::atomic<uint64_t> droppedMessages;		// chat frames evicted
+	std::atomic<uint64_t> droppedPresence;		// presence frames evicted
+	std::atomic<uint64_t> overLimit;			// pushes that left a connection over its limits
+	std::atomic<uint64_t> disconnects;			// slow consumers disconnected after grace period
+	std::atomic<uint64_t> batches;				// batch frames sent to clients announcing featureBatch
+	std::atomic<uint64_t> batchedInfos;			// informations packed into them
+	std::atomic<uint64_t> compressedFrames;		// frames compressed for clients announcing featureCompression
+	std::atomic<uint64_t> rawBytes;				// their size before compression
+	std::atomic<uint64_t> compressedBytes;		// their size after compression
+
+	OutboundStats() {
+		droppedMessages = droppedPresence = overLimit = disconnects = batches = batchedInfos = 0;
+		compressedFrames = rawBytes = compressedBytes = 0;
+	}
+
+	// add counters of a packer and reset them
+	void addBatches(BatchPacker& _packer)
+	{
+		if (_packer.batches == 0)
+			return;
+
+		batches += _packer.batches;
+		batchedInfos += _packer.packed;
+		_packer.batches = _packer.packed = 0;
+	}
+
+	// add counters of a compressor and reset them
+	void addCompression(FrameCompressor& _compressor)
+	{
+		if (_compressor.frames == 0)
+			return;
+
+		compressedFrames += _compressor.frames;
+		rawBytes += _compressor.rawBytes;
+		compressedBytes += _compressor.compressedBytes;
+		_compressor.frames = _compressor.rawBytes = _compressor.compressedBytes = 0;
+	}
+};
+
+// how queued frames of a connection are written
+enum class WriteMode
+{
+	immediate,		// written as soon as the frames queued together are in (lowest latency)
+	coalescing		// held back up to CoalescePolicy::budget so frames queued later join the same write
+};
+
+// when connections of an event loop switch from immediate to coalescing writes
+// a connection coalesces while its queue is deep or its loop is saturated, otherwise it writes immediately
+struct CoalescePolicy
+{
+	std::chrono::microseconds budget = std::chrono::microseconds(0);	// max time frames are held back (zero, the default, always writes immediately)
+	size_t deepFrames = 16;				// queued frames from which a queue counts as deep
+	size_t holdBytes = 32 * 1024;		// held frames are written as soon as this many bytes are queued
+	float busyLoad = 0.75f;				// share of time a loop spends working from which it counts as saturated
+};
+
+constexpr size_t WRITE_HISTOGRAM_BUCKETS = 10;	// informations per write : 1, 2, 3-4, 5-8, ... 129-256, more
+
+// write counters of one event loop (updated by its thread only, read from anywhere)
+struct WriteStats
+{
+	std::atomic<uint64_t> immediateWrites;		// sends made in immediate mode
+	std::atomic<uint64_t> coalescedWrites;		// sends made in coalescing mode
+	std::atomic<uint64_t> coalescingConnections;	// connections currently in coalescing mode
+	std::atomic<uint64_t> infosPerWrite[WRITE_HISTOGRAM_BUCKETS];	// histogram of informations gathered into one send (batches count what they hold)
+
+	WriteStats() {
+		immediateWrites = coalescedWrites = coalescingConnections = 0;
+		for (auto& b : infosPerWrite)
+			b = 0;
+	}
+
+	// returns histogram bucket of an information count (bucket i holds counts up to 2^i)
+	static size_t bucket(size_t _infos)
+	{
+		size_t b = 0;
+		while (b + 1 < WRITE_HISTOGRAM_BUCKETS && (size_t(1) << b) < _infos)
+			b++;
+		return b;
+	}
+
+	// count one send of _infos informations
+	void record(size_t _infos, WriteMode _mode)
+	{
+		auto& writes = _mode == WriteMode::immediate ? immediateWrites : coalescedWrites;
+		writes.store(writes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);		// single writer, no locked add
+
+		auto& b = infosPerWrite[bucket(_infos)];
+		b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+};
+
+// write counters summed over event loops
+struct WriteMetrics
+{
+	uint64_t immediateWrites = 0;
+	uint64_t coalescedWrites = 0;
+	uint64_t coalescingConnections = 0;
+	uint64_t infosPerWrite[WRITE_HISTOGRAM_BUCKETS] = {};
+
+	// add counters of one loop
+	void add(const WriteStats& _stats)
+	{
+		immediateWrites += _stats.immediateWrites;
+		coalescedWrites += _stats.coalescedWrites;
+		coalescingConnections += _stats.coalescingConnections;
+		for (size_t i = 0; i < WRITE_HISTOGRAM_BUCKETS; i++)
+			infosPerWrite[i] += _stats.infosPerWrite[i];
+	}
+};
+
+// frames waiting to be written to one connection, bounded by OutboundLimits
+// not thread safe, owner must serialize access
+class OutboundQueue
+{
+	struct Entry
+	{
+		SharedFrame frame;		// encoded frame
+		FrameClass type;		// eviction class
+		size_t infos;			// informations in frame (more than one for a batch)
+	};
+
+	std::deque<Entry> frames;	// queued frames, front is written first
+	size_t offset = 0;			// bytes of front frame already written
+	size_t bytes = 0;			// unsent bytes in queue
+	size_t pinned = 0;			// frames at front referenced by an in flight write (never evicted)
+	size_t prepared = 0;		// frames at front already packed and compressed (see prepare)
+
+	bool over = false;			// true while over limits
+	std::chrono::steady_clock::time_point overSince;	// when limits were first exceeded
+
+	// returns true if queue is over given limits
+	bool isOver(const OutboundLimits& _limits) const
+	{
+		return bytes > _limits.maxBytes || frames.size() > _limits.maxFrames;
+	}
+
+	// evict oldest frames of given class until under limits
+	// returns number of frames evicted
+	size_t evict(FrameClass _type, const OutboundLimits& _limits)
+	{
+		size_t first = pinned > 0 ? pinned : (offset > 0 ? 1 : 0);	// frames being written stay
+		size_t evicted = 0;
+
+		for (size_t i = first; i < frames.size() && isOver(_limits);)
+		{
+			if (frames[i].type != _type)
+			{
+				i++;
+				continue;
+			}
+
+			bytes -= frames[i].frame->size();
+			frames.erase(frames.begin() + i);
+			evicted++;
+			if (i < prepared)
+				prepared--;
+		}
+
+		return evicted;
+	}
+
+public:
+	// queue a frame and apply overflow policies
+	// returns false if connection has been over its limits for longer than the grace period and should be disconnected
+	bool push(const SharedFrame& _frame, FrameClass _type, const OutboundLimits& _limits, OutboundStats& _stats)
+	{
+		frames.push_back({ _frame, _type, 1 });
+		bytes += _frame->size();
+
+		if (!isOver(_limits))
+		{
+			over = false;
+			return true;
+		}
+
+		if (_limits.dropOldestMessages)
+			_stats.droppedMessages += evict(FrameClass::chat, _limits);
+
+		if (_limits.dropPresence && isOver(_limits))
+			_stats.droppedPresence += evict(FrameClass::presence, _limits);
+
+		if (!isOver(_limits))
+		{
+			over = false;
+			return true;
+		}
+
+		_stats.overLimit++;
+
+		auto now = std::chrono::steady_clock::now();
+		if (!over)
+		{
+			over = true;
+			overSince = now;
+		}
+
+		if (now - overSince < _limits.grace)
+			return true;
+
+		_stats.disconnects++;
+		return false;
+	}
+
+	// check the grace period of a queue that could not be written (nothing pushed, so push did not check it)
+	// returns false if connection has been over its limits for longer than the grace period and should be disconnected
+	bool checkGrace(const OutboundLimits& _limits, OutboundStats& _stats)
+	{
+		if (!isOver(_limits))
+		{
+			over = false;
+			return true;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (!over)
+		{
+			over = true;
+			overSince = now;
+		}
+
+		if (now - overSince < _limits.grace)
+			return true;
+
+		_stats.disconnects++;
+		return false;
+	}
+
+	// pack frames queued since the last call into batch frames and compress them (frames being written are left alone)
+	// _packer : packs frames into batch frames (nullptr to leave them as queued)
+	// _compressor : compresses frames (nullptr to leave them raw)
+	// _shared : reuses frames already compressed for other connections (nullptr to compress every frame)
+	void prepare(BatchPacker* _packer, FrameCompressor* _compressor, CompressedFrames* _shared = nullptr)
+	{
+		size_t first = pinned > 0 ? pinned : (offset > 0 ? 1 : 0);
+		if (prepared < first)
+			prepared = first;
+		if (frames.size() - prepared < 2)		// nothing to pack
+			_packer = nullptr;
+		if (_packer == nullptr && _compressor == nullptr)
+		{
+			prepared = frames.size();
+			return;
+		}
+
+		size_t write = prepared;	// prepared frames are written back in place (never ahead of the read position)
+		auto emit = [&](const SharedFrame& _frame, FrameClass _type, size_t _infos) {
+			SharedFrame frame = _frame;
+			if (_compressor != nullptr)
+				frame = _shared != nullptr ? _shared->compress(_frame, *_compressor) : _compressor->compress(_frame);
+			bytes += frame->size();
+			frames[write++] = Entry{ std::move(frame), _type, _infos };
+		};
+		for (size_t read = prepared; read < frames.size(); read++)
+		{
+			Entry e = std::move(frames[read]);
+			bytes -= e.frame->size();
+			if (_packer != nullptr)
+				_packer->add(e.frame, e.type, emit);
+			else
+				emit(e.frame, e.type, e.infos);
+		}
+		if (_packer != nullptr)
+			_packer->finish(emit);
+
+		frames.resize(write);
+		prepared = write;
+	}
+
+	// returns number of queued frames
+	size_t size() const
+	{
+		return frames.size();
+	}
+
+	// returns true if nothing is waiting to be written
+	bool empty() const
+	{
+		return frames.empty();
+	}
+
+	// returns unsent bytes
+	size_t byteSize() const
+	{
+		return bytes;
+	}
+
+	// fill _buffers with views of queued frames (first one starting after bytes already written)
+	// returns number of buffers filled
+	size_t gather(std::string_view* _buffers, size_t _max) const
+	{
+		size_t count = 0;
+		for (auto e = frames.begin(); e != frames.end() && count < _max; e++, count++)
+		{
+			_buffers[count] = *e->frame;
+			if (count == 0)
+				_buffers[count].remove_prefix(offset);
+		}
+		return count;
+	}
+
+	// returns informations in the first _count frames (as gathered)
+	size_t infos(size_t _count) const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < _count && i < frames.size(); i++)
+			total += frames[i].infos;
+		return total;
+	}
+
+	// protect first _count frames from eviction while an asynchronous write references them (0 to release)
+	void pin(size_t _count)
+	{
+		pinned = _count;
+	}
+
+	// drop _bytes of written data from the front
+	void consume(size_t _bytes)
+	{
+		bytes -= _bytes;
+		while (_bytes > 0 && !frames.empty())
+		{
+			size_t left = frames.front().frame->size() - offset;
+			if (_bytes < left)
+			{
+				offset += _bytes;
+				return;
+			}
+
+			_bytes -= left;
+			frames.pop_front();
+			offset = 0;
+			if (prepared > 0)
+				prepared--;
+		}
+	}
+};
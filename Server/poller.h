@@ -0,0 +1,242 @@
+#pragma once
+
+#include "../Client/Networking.h"
+
+#include <chrono>
+#include <vector>
+
+#ifdef _WIN32
+#include <unordered_map>
+#else
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+// readiness flags reported by the poller
+enum PollEvent
+{
+	pollRead = 1,		// socket has data to read
+	pollWrite = 2,		// socket can accept more data
+	pollClosed = 4		// socket closed or errored
+};
+
+// single readiness result
+struct PollResult
+{
+	SOCKET socketID;	// socket that is ready
+	int events;			// combination of PollEvent flags
+};
+
+// wraps the os readiness api (epoll on linux, WSAPoll on windows)
+// a poller is owned and used by a single event loop thread, only wake() may be called from other threads
+class Poller
+{
+#ifdef _WIN32
+	std::vector<WSAPOLLFD> fds;					// sockets being watched
+	std::unordered_map<SOCKET, size_t> index;	// socket to position in fds
+#else
+	int epollID = -1;							// epoll instance
+	int wakeID = -1;							// eventfd used to interrupt wait
+	int timerID = -1;							// timerfd used to end wait at a deadline (wakeAfter)
+	std::vector<epoll_event> events;			// buffer for ready events
+#endif
+
+#ifndef _WIN32
+	// convert PollEvent interest to epoll flags
+	static uint32_t toNative(int _interest)
+	{
+		uint32_t flags = 0;
+		if (_interest & pollRead)	flags |= EPOLLIN;
+		if (_interest & pollWrite)	flags |= EPOLLOUT;
+		return flags;
+	}
+#endif
+
+public:
+	// create poller
+	// returns true if created
+	bool create()
+	{
+#ifdef _WIN32
+		return true;
+#else
+		epollID = epoll_create1(0);
+		if (epollID == -1)
+		{
+			std::cerr << "Epoll creation failed with error: " << errno << std::endl;
+			return false;
+		}
+
+		wakeID = eventfd(0, EFD_NONBLOCK);
+		if (wakeID == -1)
+		{
+			std::cerr << "Eventfd creation failed with error: " << errno << std::endl;
+			return false;
+		}
+
+		timerID = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (timerID == -1)
+		{
+			std::cerr << "Timerfd creation failed with error: " << errno << std::endl;
+			return false;
+		}
+
+		epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.fd = wakeID;
+		epoll_ctl(epollID, EPOLL_CTL_ADD, wakeID, &ev);
+		ev.data.fd = timerID;
+		epoll_ctl(epollID, EPOLL_CTL_ADD, timerID, &ev);
+
+		events.resize(256);
+		return true;
+#endif
+	}
+
+	// start watching socket
+	// _interest : combination of pollRead and pollWrite
+	bool add(SOCKET _socketID, int _interest)
+	{
+#ifdef _WIN32
+		WSAPOLLFD fd = {};
+		fd.fd = _socketID;
+		fd.events = (_interest & pollRead ? POLLRDNORM : 0) | (_interest & pollWrite ? POLLWRNORM : 0);
+		index[_socketID] = fds.size();
+		fds.push_back(fd);
+		return true;
+#else
+		epoll_event ev = {};
+		ev.events = toNative(_interest);
+		ev.data.fd = _socketID;
+		return epoll_ctl(epollID, EPOLL_CTL_ADD, _socketID, &ev) == 0;
+#endif
+	}
+
+	// change interest of a watched socket
+	bool modify(SOCKET _socketID, int _interest)
+	{
+#ifdef _WIN32
+		auto it = index.find(_socketID);
+		if (it == index.end())
+			return false;
+		fds[it->second].events = (_interest & pollRead ? POLLRDNORM : 0) | (_interest & pollWrite ? POLLWRNORM : 0);
+		return true;
+#else
+		epoll_event ev = {};
+		ev.events = toNative(_interest);
+		ev.data.fd = _socketID;
+		return epoll_ctl(epollID, EPOLL_CTL_MOD, _socketID, &ev) == 0;
+#endif
+	}
+
+	// stop watching socket (call before closing it)
+	void remove(SOCKET _socketID)
+	{
+#ifdef _WIN32
+		auto it = index.find(_socketID);
+		if (it == index.end())
+			return;
+
+		size_t pos = it->second;				// swap with last to keep fds packed
+		fds[pos] = fds.back();
+		index[fds[pos].fd] = pos;
+		fds.pop_back();
+		index.erase(_socketID);
+#else
+		epoll_ctl(epollID, EPOLL_CTL_DEL, _socketID, nullptr);
+#endif
+	}
+
+	// wait for ready sockets
+	// _out : ready sockets (cleared first)
+	// _timeoutMs : max time to wait (-1 waits until something is ready or wake is called)
+	// returns number of ready sockets
+	int wait(std::vector<PollResult>& _out, int _timeoutMs)
+	{
+		_out.clear();
+#ifdef _WIN32
+		if (fds.empty())
+		{
+			Sleep(_timeoutMs < 0 ? 1 : _timeoutMs);
+			return 0;
+		}
+
+		int ready = WSAPoll(fds.data(), (ULONG)fds.size(), _timeoutMs);
+		for (size_t i = 0; i < fds.size() && ready > 0; i++)
+		{
+			short r = fds[i].revents;
+			if (r == 0)
+				continue;
+
+			int ev = 0;
+			if (r & POLLRDNORM)						ev |= pollRead;
+			if (r & POLLWRNORM)						ev |= pollWrite;
+			if (r & (POLLERR | POLLHUP | POLLNVAL))	ev |= pollClosed;
+			_out.push_back({ fds[i].fd, ev });
+		}
+#else
+		int ready = epoll_wait(epollID, events.data(), (int)events.size(), _timeoutMs);
+		for (int i = 0; i < ready; i++)
+		{
+			if (events[i].data.fd == wakeID || events[i].data.fd == timerID)	// drain wake counter or expired timer
+			{
+				uint64_t count;
+				while (read(events[i].data.fd, &count, sizeof(count)) > 0);
+				continue;
+			}
+
+			int ev = 0;
+			if (events[i].events & EPOLLIN)				ev |= pollRead;
+			if (events[i].events & EPOLLOUT)			ev |= pollWrite;
+			if (events[i].events & (EPOLLERR | EPOLLHUP))	ev |= pollClosed;
+			_out.push_back({ events[i].data.fd, ev });
+		}
+#endif
+		return (int)_out.size();
+	}
+
+	// interrupt a blocking wait from another thread
+	// (no-op on windows, event loops poll with a short timeout there)
+	void wake()
+	{
+#ifndef _WIN32
+		uint64_t one = 1;
+		write(wakeID, &one, sizeof(one));
+#endif
+	}
+
+	// end a wait after _delay at the latest (one shot, replaces an earlier deadline)
+	// precise to microseconds where a timer can be armed, no-op on windows (loops poll every millisecond there)
+	void wakeAfter(std::chrono::microseconds _delay)
+	{
+#ifndef _WIN32
+		if (_delay.count() <= 0)
+			_delay = std::chrono::microseconds(1);		// zero would disarm the timer
+
+		itimerspec spec = {};
+		spec.it_value.tv_sec = time_t(_delay.count() / 1000000);
+		spec.it_value.tv_nsec = long(_delay.count() % 1000000) * 1000;
+		timerfd_settime(timerID, 0, &spec, nullptr);
+#endif
+	}
+
+	// destroy poller
+	void destroy()
+	{
+#ifdef _WIN32
+		fds.clear();
+		index.clear();
+#else
+		if (wakeID != -1)	close(wakeID);
+		if (timerID != -1)	close(timerID);
+		if (epollID != -1)	close(epollID);
+		wakeID = timerID = epollID = -1;
+#endif
+	}
+
+	~Poller()
+	{
+		destroy();
+	}
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "roster.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+constexpr std::chrono::milliseconds PRESENCE_WINDOW(50);	// default time joins and leaves are collected before broadcasting
+
+// collects roster changes over a short window and broadcasts them as one rosterChanges info
+// a join and leave of the same user inside the window cancel out, so reconnect storms cost one frame per window
+// with a zero window every change is broadcast at once as clientJoined / clientLeft
+class PresenceBatcher
+{
+	Roster& roster;
+	std::function<void(const std::string&)> publish;	// broadcasts an encoded info (called under the roster lock)
+	std::chrono::milliseconds window;
+
+	std::thread* flushThread = nullptr;
+	std::mutex mtx;										// protects pending and running
+	std::condition_variable cv;
+	bool pending = false;								// changes waiting for flush
+	bool running = false;
+
+	// thread method, waits for a change, lets the window pass and flushes
+	void flushLoop()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		while (running)
+		{
+			cv.wait(lock, [this] { return pending || !running; });
+			if (!running)
+				break;
+
+			cv.wait_for(lock, window, [this] { return !running; });	// collect changes for one window
+			pending = false;
+
+			lock.unlock();
+			roster.flush(publish);
+			lock.lock();
+		}
+	}
+
+	// wake flush thread for a new change
+	void changed()
+	{
+		if (flushThread == nullptr)
+			return;
+
+		std::lock_guard<std::mutex> lock(mtx);		// critical section
+		if (!pending)
+		{
+			pending = true;
+			cv.notify_one();
+		}
+	}
+
+public:
+	PresenceBatcher(Roster& _roster) :roster(_roster), window(PRESENCE_WINDOW) {}
+
+	// set collection window (call before start, zero broadcasts every change at once)
+	void setWindow(std::chrono::milliseconds _window) {
+		window = _window;
+	}
+
+	// start batching
+	// _publish : broadcasts an encoded info to every client
+	void start(std::function<void(const std::string&)> _publish)
+	{
+		publish = _publish;
+		if (window.count() <= 0)
+			return;
+
+		roster.setBatching(true);
+		running = true;
+		flushThread = new std::thread(&PresenceBatcher::flushLoop, this);
+	}
+
+	// add user to roster and broadcast its join (now or with the next batch)
+	void join(const User& _user)
+	{
+		roster.join(_user, publish);
+		changed();
+	}
+
+	// remove user from roster and broadcast its leave (now or with the next batch)
+	void leave(const User& _user)
+	{
+		roster.leave(_user, publish);
+		changed();
+	}
+
+	// stop flush thread, changes still waiting are broadcast at once
+	void stop()
+	{
+		if (flushThread == nullptr)
+			return;
+
+		mtx.lock();									// critical section begin
+		running = false;
+		cv.notify_one();
+		mtx.unlock();								// critical section end
+
+		flushThread->join();
+		delete flushThread;
+		flushThread = nullptr;
+
+		roster.flush(publish);
+	}
+
+	~PresenceBatcher()
+	{
+		stop();
+	}
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "../Client/Networking.h"
+#include "../Client/MessageQueue.h"
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+// open addressing hash map from integer keys to small values (linear probing, power of two capacity)
+// slots are one flat array and erase shifts followers back, so there are no tombstones and lookups stay short
+template<typename K, typename V>
+class FlatMap
+{
+	struct Slot
+	{
+		K key;
+		V value;
+		bool used = false;
+	};
+
+	std::vector<Slot> slots;
+	size_t mask = 0;		// capacity - 1
+	size_t count = 0;		// used slots
+
+	// returns home slot of a key (fibonacci hashing spreads sequential ids)
+	size_t home(K _key) const {
+		return size_t((uint64_t(_key) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+	}
+
+	// double capacity and reinsert every key
+	void grow()
+	{
+		std::vector<Slot> old(slots.empty() ? 16 : slots.size() * 2);
+		old.swap(slots);
+		mask = slots.size() - 1;
+		count = 0;
+
+		for (auto& s : old)
+			if (s.used)
+				set(s.key, std::move(s.value));
+	}
+
+public:
+	// returns value of a key or nullptr if not present
+	V* find(K _key)
+	{
+		if (count == 0)
+			return nullptr;
+
+		for (size_t i = home(_key);; i = (i + 1) & mask)
+		{
+			if (!slots[i].used)		return nullptr;
+			if (slots[i].key == _key)	return &slots[i].value;
+		}
+	}
+
+	// insert or replace value of a key
+	void set(K _key, V _value)
+	{
+		if ((count + 1) * 4 > slots.size() * 3)		// keep load under 3/4
+			grow();
+
+		size_t i = home(_key);
+		while (slots[i].used && slots[i].key != _key)
+			i = (i + 1) & mask;
+
+		if (!slots[i].used)
+			count++;
+
+		slots[i].key = _key;
+		slots[i].value = std::move(_value);
+		slots[i].used = true;
+	}
+
+	// remove a key
+	// returns false if it was not present
+	bool erase(K _key)
+	{
+		if (count == 0)
+			return false;
+
+		size_t i = home(_key);
+		for (;; i = (i + 1) & mask)
+		{
+			if (!slots[i].used)		return false;
+			if (slots[i].key == _key)	break;
+		}
+
+		// shift back followers that probed past the freed slot
+		for (size_t j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask)
+		{
+			size_t h = home(slots[j].key);
+			if (((j - h) & mask) >= ((j - i) & mask))
+			{
+				slots[i] = std::move(slots[j]);
+				i = j;
+			}
+		}
+
+		slots[i].used = false;
+		count--;
+		return true;
+	}
+
+	// number of keys
+	size_t size() const {
+		return count;
+	}
+};
+
+// registered connections indexed by user id
+// connections are kept in a dense array (cheap to walk for broadcasts), lookups are O(1)
+// (loops and receive threads already hold their connection by socket, so there is no socket index to keep up)
+// not thread safe, owner must serialize access
+template<typename Conn>
+class ConnectionRegistry
+{
+public:
+	struct Entry
+	{
+		int id;				// user id
+		SOCKET socketID;	// socket of the connection
+		Conn conn;			// connection data
+	};
+
+private:
+	std::vector<Entry> entries;					// registered connections in no particular order
+	FlatMap<int, uint32_t> byId;				// user id -> index in entries
+
+	// remove entry at _index by moving last entry into its place
+	void removeAt(uint32_t _index)
+	{
+		byId.erase(entries[_index].id);
+
+		uint32_t last = uint32_t(entries.size() - 1);
+		if (_index != last)
+		{
+			entries[_index] = std::move(entries[last]);
+			byId.set(entries[_index].id, _index);
+		}
+		entries.pop_back();
+	}
+
+public:
+	// register a connection (replaces any connection with the same id)
+	void add(int _id, SOCKET _socketID, Conn _conn)
+	{
+		removeById(_id);
+
+		uint32_t index = uint32_t(entries.size());
+		entries.push_back(Entry{ _id, _socketID, std::move(_conn) });
+		byId.set(_id, index);
+	}
+
+	// returns connection of a user or nullptr if not registered
+	Conn* findById(int _id)
+	{
+		uint32_t* index = byId.find(_id);
+		return index != nullptr ? &entries[*index].conn : nullptr;
+	}
+
+	// unregister connection of a user
+	// returns false if not registered
+	bool removeById(int _id)
+	{
+		uint32_t* index = byId.find(_id);
+		if (index == nullptr)
+			return false;
+
+		removeAt(*index);
+		return true;
+	}
+
+	// number of registered connections
+	size_t size() const {
+		return entries.size();
+	}
+
+	// walk registered connections (invalidated by add and remove)
+	typename std::vector<Entry>::iterator begin() { return entries.begin(); }
+	typename std::vector<Entry>::iterator end() { return entries.end(); }
+};
+
+constexpr size_t REGISTRY_SHARDS = 16;		// shards of a server's connection registry (power of two)
+
+// connection registry split into shards by user id, each behind its own reader / writer lock
+// lookups and walks take shared locks so they run in parallel, joins and leaves only lock one shard
+template<typename Conn, size_t SHARDS = REGISTRY_SHARDS>
+class ShardedRegistry
+{
+	static_assert((SHARDS & (SHARDS - 1)) == 0, "shard count must be a power of two");
+
+	struct alignas(CACHE_LINE_SIZE) Shard
+	{
+		std::shared_mutex mtx;					// protects registry
+		ConnectionRegistry<Conn> registry;
+	};
+
+	Shard shards[SHARDS];
+
+	// returns shard of a user id
+	Shard& shardOf(int _id) {
+		return shards[size_t((uint64_t(_id) * 0x9E3779B97F4A7C15ull) >> 32) & (SHARDS - 1)];
+	}
+
+public:
+	// register a connection (replaces any connection with the same id)
+	void add(int _id, SOCKET _socketID, Conn _conn)
+	{
+		Shard& s = shardOf(_id);
+		std::unique_lock<std::shared_mutex> lock(s.mtx);
+		s.registry.add(_id, _socketID, std::move(_conn));
+	}
+
+	// unregister connection of a user
+	// returns false if not registered
+	bool removeById(int _id)
+	{
+		Shard& s = shardOf(_id);
+		std::unique_lock<std::shared_mutex> lock(s.mtx);
+		return s.registry.removeById(_id);
+	}
+
+	// copy connection of a user into _out
+	// returns false if not registered
+	bool findById(int _id, Conn& _out)
+	{
+		Shard& s = shardOf(_id);
+		std::shared_lock<std::shared_mutex> lock(s.mtx);
+
+		Conn* c = s.registry.findById(_id);
+		if (c == nullptr)
+			return false;
+
+		_out = *c;
+		return true;
+	}
+
+	// call _visit with every registered entry, one shard at a time under its shared lock
+	// (_visit must not touch the registry, joins and leaves on other shards may interleave)
+	template<typename Visit>
+	void forEach(Visit _visit)
+	{
+		for (auto& s : shards)
+		{
+			std::shared_lock<std::shared_mutex> lock(s.mtx);
+			for (auto& e : s.registry)
+				_visit(e);
+		}
+	}
+
+	// number of registered connections (approximate while joins and leaves are running)
+	size_t size()
+	{
+		size_t total = 0;
+		for (auto& s : shards)
+		{
+			std::shared_lock<std::shared_mutex> lock(s.mtx);
+			total += s.registry.size();
+		}
+		return total;
+	}
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "../Client/NetworkData.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+constexpr size_t ROSTER_LOG_SIZE = 4096;	// changes kept for incremental sync, older clients get a snapshot
+constexpr size_t ROSTER_PAGE_SIZE = 512;	// users per snapshot page
+
+// versioned list of registered users with a bounded log of recent changes
+// every join or leave bumps the version, clients sync with the changes since the version they have
+// changes are published one by one, or in batches by flush when batching is on
+// publish and send callbacks run under the roster lock, so infos are queued in version order
+class Roster
+{
+	std::mutex mtx;								// protects everything below
+
+	uint64_t version;							// current version
+	std::map<unsigned int, std::string> users;	// registered users by id
+	std::deque<RosterChange> log;				// last changes, newest at back
+
+	bool batching = false;						// changes wait for flush instead of being published one by one
+	uint64_t publishedVersion;					// version every client has been sent changes up to
+	uint64_t lastSyncVersion = 0;				// version of the latest sync answer
+
+	uint64_t pagesVersion = 0;					// version of cached snapshot pages
+	std::vector<std::string> pages;				// encoded snapshot infos, reused until the roster changes
+
+	// record a change and publish it as a presence info (unless batching)
+	template<typename Publish>
+	void record(bool _joined, const User& _user, Publish& _publish)
+	{
+		RosterChange change(++version, _joined, _user);
+
+		log.push_back(change);
+		if (log.size() > ROSTER_LOG_SIZE)
+			log.pop_front();
+
+		if (batching)
+			return;
+
+		_publish(NetInfo(_joined ? NetInfoType::clientJoined : NetInfoType::clientLeft, change.encode()).encode());
+		publishedVersion = version;
+	}
+
+	// collect logged changes after _from (log must cover _from)
+	// a user that joined and left within them is left out, only its leave is kept if a receiver
+	// may already know of the join (join version not above _seenUpTo, 0 when every receiver holds exactly _from)
+	RosterChanges changesSince(uint64_t _from, uint64_t _seenUpTo)
+	{
+		RosterChanges delta;
+		delta.from = _from;
+		delta.to = version;
+
+		std::unordered_map<unsigned int, size_t> joinedAt;		// index of a join within delta
+		std::vector<bool> cancelled;
+		for (auto& c : log)
+		{
+			if (c.version <= _from)
+				continue;
+
+			auto j = joinedAt.find(c.user.id);
+			if (!c.joined && j != joinedAt.end())			// joined and left since _from
+			{
+				bool seen = delta.changes[j->second].version <= _seenUpTo;
+				cancelled[j->second] = true;
+				joinedAt.erase(j);
+				if (!seen)
+					continue;
+			}
+
+			if (c.joined)
+				joinedAt[c.user.id] = delta.changes.size();
+			delta.changes.push_back(c);
+			cancelled.push_back(false);
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < delta.changes.size(); i++)
+			if (!cancelled[i])
+				delta.changes[kept++] = delta.changes[i];
+		delta.changes.resize(kept);
+
+		return delta;
+	}
+
+	// returns true if the log holds every change after _known
+	bool covers(uint64_t _known) const
+	{
+		if (_known > version)
+			return false;
+		return _known == version || (!log.empty() && log.front().version <= _known + 1);
+	}
+
+	// encode snapshot pages of current version (cached until next change)
+	const std::vector<std::string>& snapshotPages()
+	{
+		if (pagesVersion == version && !pages.empty())
+			return pages;
+
+		pages.clear();
+		pagesVersion = version;
+
+		RosterSnapshot page;
+		page.version = version;
+		page.total = uint32_t(users.size());
+
+		auto u = users.begin();
+		do {
+			page.first = page.first + uint32_t(page.users.size());
+			page.users.clear();
+			for (; u != users.end() && page.users.size() < ROSTER_PAGE_SIZE; u++)
+				page.users.emplace_back(u->first, u->second);
+
+			pages.push_back(NetInfo(NetInfoType::rosterSnapshot, page.encode()).encode());
+		} while (u != users.end());
+
+		return pages;
+	}
+
+public:
+	// versions start from the time the roster was created, so versions of an earlier server run are never mistaken for current ones
+	Roster() {
+		version = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+		publishedVersion = version;
+	}
+
+	// hold changes back for flush instead of publishing each one
+	void setBatching(bool _batching)
+	{
+		std::lock_guard<std::mutex> lock(mtx);		// critical section
+		batching = _batching;
+	}
+
+	// publish every change since the last flush as one rosterChanges info
+	// (snapshot pages if more changes happened than the log holds)
+	// _publish : called with encoded info to broadcast
+	// returns false if there was nothing to publish
+	template<typename Publish>
+	bool flush(Publish _publish)
+	{
+		std::lock_guard<std::mutex> lock(mtx);		// critical section
+
+		if (publishedVersion == version)
+			return false;
+
+		if (!covers(publishedVersion))
+		{
+			for (auto& p : snapshotPages())
+				_publish(p);
+		}
+		else
+		{
+			uint64_t seenUpTo = lastSyncVersion > publishedVersion ? lastSyncVersion : 0;	// clients synced since last flush
+			_publish(NetInfo(NetInfoType::rosterChanges, changesSince(publishedVersion, seenUpTo).encode()).encode());
+		}
+
+		publishedVersion = version;
+		return true;
+	}
+
+	// returns current version
+	uint64_t currentVersion()
+	{
+		std::lock_guard<std::mutex> lock(mtx);		// critical section
+		return version;
+	}
+
+	// add a user and publish clientJoined (unless batching)
+	// _publish : called with encoded info to broadcast
+	template<typename Publish>
+	void join(const User& _user, Publish _publish)
+	{
+		std::lock_guard<std::mutex> lock(mtx);		// critical section
+
+		users[_user.id] = _user.username;
+		record(true, _user, _publish);
+	}
+
+	// remove a user and publish clientLeft (unless batching)
+	// _publish : called with encoded info to broadcast
+	template<typename Publish>
+	void leave(const User& _user, Publish _publish)
+	{
+		std::lock_guard<std::mutex> lock(mtx);		// critical section
+
+		if (users.erase(_user.id) > 0)
+			record(false, _user, _publish);
+	}
+
+	// answer a client holding version _known: changes since then if still logged, otherwise snapshot pages
+	// a user that joined and left within the changes is left out entirely
+	// _send : called with each encoded info for that client
+	template<typename Send>
+	void sync(uint64_t _known, Send _send)
+	{
+		std::lock_guard<std::mutex> lock(mtx);		// critical section
+
+		lastSyncVersion = version;
+
+		if (_known == 0 || !covers(_known))
+		{
+			for (auto& p : snapshotPages())
+				_send(p);
+			return;
+		}
+
+		_send(NetInfo(NetInfoType::rosterChanges, changesSince(_known, 0).encode()).encode());
+	}
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "../Client/Networking.h"
+#include "../Client/MessageQueue.h"
+#include "../Client/NetworkData.h"
+#include "outbound.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// connection of the threaded server with its own outbound queue
+// shared between its receive thread, the registry and sender workers, the socket is closed with the last owner
+struct Peer
+{
+	SOCKET socketID;						// socket of this connection
+	User user;								// user of this connection
+
+	OutboundQueue outbound;					// frames waiting to be written to this connection
+	std::mutex outboundMtx;					// protects outbound
+	std::atomic<bool> scheduled;			// true while queued on or drained by a sender worker
+	std::atomic<bool> broken;				// true after a failed write, later frames are dropped
+	std::atomic<bool> batching;				// client announced featureBatch, frames written together are packed into batch frames
+	std::unique_ptr<FrameCompressor> compressor;	// set at handshake if client announced featureCompression
+
+	Peer(SOCKET _socketID) :socketID(_socketID) {
+		scheduled = false;
+		broken = false;
+		batching = false;
+	}
+
+	~Peer()
+	{
+		closesocket(socketID);
+	}
+};
+
+constexpr auto SEND_RETRY = std::chrono::milliseconds(1);	// how soon a worker retries peers whose socket was full
+
+// pool of threads writing peers' outbound queues
+// a peer is drained by one worker at a time, writes never wait on a full socket (on linux): the worker
+// keeps the peer and retries it a little later while serving others, the unsent tail stays in the peer's queue
+class SenderPool
+{
+	MutexQueue<std::shared_ptr<Peer>> ready;	// peers with frames to write (many workers dequeue)
+	std::vector<std::thread*> workers;			// sender threads
+
+	OutboundLimits limits;						// caps on data queued per peer
+	OutboundStats stats;						// how often overflow policies fired
+
+	std::atomic<bool> running;
+
+	// write queued frames of a peer until its queue is empty or its socket is full
+	// frames stay queued (and counted against the peer's limits) until written, frames being written are pinned
+	// so posts in the meantime never evict them
+	// _packer : packs the frames into batch frames if the peer takes them
+	// frames are then compressed if the peer negotiated it (its receive thread only decompresses, so the draining worker owns compression)
+	// returns false if the socket is full and frames are left
+	bool drain(Peer& _peer, BatchPacker& _packer)
+	{
+		std::string_view buffers[MAX_SEND_BUFFERS];
+		while (!_peer.broken)
+		{
+			_peer.outboundMtx.lock();			// critical section begin
+			_peer.outbound.prepare(_peer.batching ? &_packer : nullptr, _peer.compressor.get());
+			size_t count = _peer.outbound.gather(buffers, MAX_SEND_BUFFERS);
+			_peer.outbound.pin(count);
+			_peer.outboundMtx.unlock();			// critical section end
+
+			stats.addBatches(_packer);
+			if (_peer.compressor)
+				stats.addCompression(*_peer.compressor);
+
+			if (count == 0)
+				return true;
+
+			int bytes = sendBuffers(_peer.socketID, buffers, count, SEND_NOWAIT_FLAGS);
+
+			_peer.outboundMtx.lock();			// critical section begin
+			if (bytes != SOCKET_ERROR)
+				_peer.outbound.consume(bytes);	// partly sent frame stays at the front
+			_peer.outbound.pin(0);
+			_peer.outboundMtx.unlock();			// critical section end
+
+			if (bytes == SOCKET_ERROR)
+			{
+				if (wouldBlock())
+					return false;
+
+				std::cerr << "Send failed with error: " << WSAGetLastError() << std::endl;
+				_peer.broken = true;
+			}
+		}
+		return true;
+	}
+
+	// shut down a slow consumer, its receive thread handles the leave
+	// _queued : bytes left in its queue (logged)
+	void disconnect(Peer& _peer, size_t _queued)
+	{
+		std::cout << "Disconnecting slow consumer " << _peer.user.username << " (" << _queued << " bytes queued)" << std::endl;
+		_peer.broken = true;
+		shutdown(_peer.socketID, SD_BOTH);		// ends its receive thread which handles the leave
+	}
+
+	// drain a scheduled peer, then release it or keep it in _blocked if its socket is full
+	// a blocked peer over its limits for longer than the grace period is shut down, even if nothing is posted to it any more
+	void serve(const std::shared_ptr<Peer>& _peer, BatchPacker& _packer, std::vector<std::shared_ptr<Peer>>& _blocked)
+	{
+		if (!drain(*_peer, _packer))
+		{
+			_peer->outboundMtx.lock();			// critical section begin
+			bool keep = _peer->outbound.checkGrace(limits, stats);
+			size_t queued = _peer->outbound.byteSize();
+			_peer->outboundMtx.unlock();		// critical section end
+
+			if (!keep)
+				disconnect(*_peer, queued);
+			else
+				_blocked.push_back(_peer);		// stays scheduled, so no other worker writes it meanwhile
+			return;
+		}
+
+		// frames posted while draining did not reschedule, so check again
+		_peer->scheduled = false;
+
+		_peer->outboundMtx.lock();				// critical section begin
+		bool pending = !_peer->outbound.empty();
+		_peer->outboundMtx.unlock();			// critical section end
+
+		if (pending && !_peer->scheduled.exchange(true))
+			ready.enqueue(_peer);
+	}
+
+	// thread method of a sender worker
+	void workerThread()
+	{
+		std::shared_ptr<Peer> peer;
+		std::vector<std::shared_ptr<Peer>> blocked;		// peers whose socket was full, retried every SEND_RETRY
+		std::vector<std::shared_ptr<Peer>> retry;
+		BatchPacker packer;
+		auto retryAt = std::chrono::steady_clock::now();
+
+		while (true)
+		{
+			// sleeps until a peer is scheduled (or the next retry), false once stopped
+			bool got = blocked.empty() ? ready.waitDequeue(peer) : ready.waitDequeue(peer, SEND_RETRY);
+			if (!running || (!got && blocked.empty()))
+				break;
+
+			if (got)
+			{
+				serve(peer, packer, blocked);
+				peer.reset();
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			if (blocked.empty() || now < retryAt)
+				continue;
+
+			retry.swap(blocked);
+			for (auto& p : retry)
+				serve(p, packer, blocked);
+			retry.clear();
+			retryAt = now + SEND_RETRY;
+		}
+	}
+
+public:
+	SenderPool() {
+		running = false;
+	}
+
+	// set caps and overflow policies for data queued per peer (call before start)
+	void setLimits(const OutboundLimits& _limits) {
+		limits = _limits;
+	}
+
+	// counters of overflow policies
+	OutboundStats& getStats() {
+		return stats;
+	}
+
+	// start sender workers
+	// _count : number of worker threads
+	void start(unsigned int _count)
+	{
+		running = true;
+		for (unsigned int i = 0; i < _count; i++)
+			workers.push_back(new std::thread(&SenderPool::workerThread, this));
+	}
+
+	// queue frame on a peer and schedule it on a worker if it is idle (never writes to the socket)
+	// a peer over its limits for longer than the grace period is shut down
+	// _type : how the frame may be evicted if the peer can not keep up
+	void post(const std::shared_ptr<Peer>& _peer, const SharedFrame& _frame, FrameClass _type)
+	{
+		if (_peer->broken)
+			return;
+
+		_peer->outboundMtx.lock();				// critical section begin
+		bool keep = _peer->outbound.push(_frame, _type, limits, stats);
+		size_t queued = _peer->outbound.byteSize();
+		_peer->outboundMtx.unlock();			// critical section end
+
+		if (!keep)
+		{
+			disconnect(*_peer, queued);
+			return;
+		}
+
+		if (!_peer->scheduled.exchange(true))
+			ready.enqueue(_peer);
+	}
+
+	// stop and join all workers
+	void stop()
+	{
+		running = false;
+		ready.close();							// wake idle workers
+		for (auto w : workers)
+		{
+			w->join();
+			delete w;
+		}
+		workers.clear();
+	}
+
+	~SenderPool()
+	{
+		stop();
+	}
+};
@@ -3,29 +3,61 @@
 #include "../Client/Networking.h"
 #include "../Client/MessageQueue.h"
 #include "../Client/NetworkData.h"
+#include "senderPool.h"
+#include "lanes.h"
+#include "registry.h"
+#include "presence.h"
+#include "inbound.h"
 
 #include <vector>
 #include <thread>
 #include <mutex>
-#include <unordered_map>
 
-static unsigned int USER_ID = 1; // 0 is reserved for all chat
+static std::atomic<unsigned int> USER_ID = 1; // 0 is reserved for all chat (atomic as ids are generated from many threads)
 
 static unsigned int GenereateID() { return USER_ID++; }
 
+// lanes of the routing queue, so a chat flood does not hold back presence updates and private messages
+enum SendLane
+{
+	laneControl,		// clientJoined / clientLeft
+	laneDirect,			// private messages
+	laneBroadcast,		// general chat
+	LANE_COUNT
+};
+
+// items each lane may route per turn
+constexpr unsigned LANE_WEIGHTS[LANE_COUNT] = { 8, 4, 1 };
+
+// frame waiting on the routing thread
+struct Routed
+{
+	int to = 0;								// user id of receiver (0 for all)
+	SharedFrame frame;						// encoded frame (header included), forwarded as is
+	NetInfoType type = NetInfoType::Null;	// type of information carried
+};
+
 class Server :public SocketBase
 {
-	MsgQueue<std::pair<int, std::string>> sendQueue;
+	LaneQueue<Routed, LANE_COUNT> sendQueue;			// frames waiting to be routed
 
-	std::thread* sendThread;
+	std::thread* sendThread = nullptr;					// routing thread
 	std::vector<std::thread*> clientThreads;
+	SenderPool senders;									// threads writing peers' outbound queues
+
+	ShardedRegistry<std::shared_ptr<Peer>> clients;		// registered peers by user id (locks itself per shard)
+	Roster roster;										// versioned user list clients sync with
+	PresenceBatcher presence{ roster };					// broadcasts roster changes in batches
 
-	std::unordered_map<SOCKET, User> clients;
+	InboundPolicy inbound;								// checks run on messages before they are queued for routing
+	std::shared_ptr<const CompressionDictionary> dictionary;	// offered to clients for compression (none if null)
 
 	std::atomic<bool> running;
-	std::mutex mtx;
 public:
-	Server() = default;
+	Server() {
+		for (size_t i = 0; i < LANE_COUNT; i++)
+			sendQueue.setWeight(i, LANE_WEIGHTS[i]);
+	}
 
 	// bind server to given port
 	// return true if bind successful
@@ -38,16 +70,63 @@ public:
 	bool start() {
 		running = SocketBase::startServer();
 		if (running)
+		{
+			unsigned int workers = std::thread::hardware_concurrency();
+			senders.start(workers > 0 ? workers : 4);
+			presence.start([this](const std::string& _info) {		// presence broadcasts go through the control lane
+				sendQueue.enqueue(laneControl, Routed{ 0, makeFrame(_info), peekType(_info) });
+			});
 			sendThread = new std::thread(&Server::sendMessageThread, this);
+		}
 		return running;
 	}
 
+	// set caps and overflow policies for data queued per connection (call before start)
+	void setOutboundLimits(const OutboundLimits& _limits) {
+		senders.setLimits(_limits);
+	}
+
+	// counters of overflow policies
+	OutboundStats& outboundStats() {
+		return senders.getStats();
+	}
+
+	// set how long joins and leaves are collected before broadcasting (call before start, zero for no batching)
+	void setPresenceWindow(std::chrono::milliseconds _window) {
+		presence.setWindow(_window);
+	}
+
+	// fully decode routed messages and check them against their routing header (call before start)
+	// off by default, routing reads only the routing header if no other check needs the text
+	void setValidateMessages(bool _validate) {
+		inbound.validateMessages = _validate;
+	}
+
+	// drop messages whose text is not valid UTF-8 (call before start, on by default)
+	void setValidateUtf8(bool _validate) {
+		inbound.validateUtf8 = _validate;
+	}
+
+	// remove control characters other than tab and new line from message text (call before start)
+	void setStripControls(bool _strip) {
+		inbound.stripControls = _strip;
+	}
+
+	// offer frame compression with a trained dictionary to clients holding the same one (call before start)
+	void setDictionary(std::shared_ptr<const CompressionDictionary> _dictionary) {
+		dictionary = std::move(_dictionary);
+	}
+
+	// depth and latency counters of a routing lane
+	const LaneStats& laneStats(SendLane _lane) const {
+		return sendQueue.getStats(_lane);
+	}
+
 	// returns a list of users for server context
 	std::vector<User> getUsers()
 	{
 		std::vector<User> users;
-		for (auto& c : clients)
-			users.emplace_back(c.second);
+		clients.forEach([&](auto& c) { users.emplace_back(c.conn->user); });
 		return users;
 	}
 
@@ -56,11 +135,10 @@ public:
 	{
 		// generate new unique id for this client
 		int id = GenereateID();
+		auto peer = std::make_shared<Peer>(socketID);				// owns the socket from here on
 
-		// create server context
-		mtx.lock();													// critical section begin
-		ServerContext sc(id, getUsers());
-		mtx.unlock();												// critical section end
+		// create server context (users follow as roster sync once the client is registered)
+		ServerContext sc(id, roster.currentVersion(), dictionary ? dictionary->id() : 0);
 
 		// send server context
 		if (!sendInfo(socketID, sc.encode()))
@@ -70,8 +148,9 @@ public:
 		}
 
 		// get client context
+		StreamBuffer buffer;										// received bytes of this connection
 		std::string info;
-		if (!recvInfo(socketID, info))
+		if (!recvInfo(socketID, buffer, info))
 		{
 			std::cout << "Client context not received" << std::endl;
 			return;
@@ -84,72 +163,96 @@ public:
 			std::cout << "Client context is corrupted" << std::endl;
 			return;
 		}
-		// critical section begin
-		mtx.lock();
-		clients.insert({ socketID,User(id, cc.username) });			// add new user to client list
-		sendQueue.enqueue(std::make_pair(0, NetInfo(NetInfoType::clientJoined, clients[socketID].encode()).encode()));	// add client joined info to send queue
-		mtx.unlock();												// critical section end
+		peer->user = User(id, cc.username);
+		peer->batching = (cc.features & featureBatch) != 0;
+		if ((cc.features & featureCompression) && dictionary)
+			peer->compressor = std::make_unique<FrameCompressor>(dictionary);	// set before any sender worker sees the peer
+
+		clients.add(id, socketID, peer);							// add new user to client list
+		presence.join(peer->user);									// add client joined info to send queue (now or with next batch)
+		info = NetInfo(NetInfoType::rosterRequest, RosterRequest(cc.rosterVersion).encode()).encode();
+		sendQueue.enqueue(laneControl, Routed{ id, makeFrame(info), NetInfoType::rosterRequest });	// roster sync, answered by routing thread
 
 		std::cout << cc.username << " Joined " << std::endl;
 
 		//message loop
-		NetInfo netInfo;
-		while (running)
+		NetInfoView netInfo;
+		FrameHeader header;
+		std::string_view payload;									// view into buffer, valid until next receive
+		RouteHeader route;
+		while (running && recvFrame(socketID, buffer, header, payload, peer->compressor.get()))	// receive frames from client
 		{
-			if (recvInfo(socketID, info))		// receive info from clients
+			if (header.type == frameRouted)		// fast path, only the routing header is read and the frame is forwarded as received
 			{
-				if (info == NETWORK_EXIT)		// check for exit message
-					break;
-
-				if (!netInfo.decode(info))		// decode info
+				if (!route.read(payload) || route.type != NetInfoType::message || route.from != uint32_t(id))
 				{
-					std::cout << "Corrupted info received from " << clients[socketID].username << std::endl;
+					std::cout << "Corrupted routing header received from " << peer->user.username << std::endl;
 					continue;
 				}
 
-				std::cout << "Received -> " << netInfo.data << std::endl;
-				if (netInfo.type == NetInfoType::message)	// check if info is a message
+				SharedFrame frame;
+				if (!acceptRouted(inbound, route, payload, frame))	// checks run here, off the routing thread
 				{
-					Message msg;
-					if (!msg.decode(netInfo.data))			// decode message from info
-					{
-						std::cout << "Corrupted message received from " << clients[socketID].username << std::endl;
-						continue;
-					}
-
-					sendQueue.enqueue(std::make_pair(msg.to, info));	// add message to send queue
+					std::cout << "Rejected message from " << peer->user.username << std::endl;
+					continue;
 				}
-				std::cout << "Received " << toString(netInfo.type) << " -> " << info << std::endl;
+
+				sendQueue.enqueue(route.to == 0 ? laneBroadcast : laneDirect, Routed{ int(route.to), std::move(frame), NetInfoType::message });
+				continue;
 			}
-			else
+
+			if (payload == NETWORK_EXIT)	// check for exit message
 				break;
+
+			if (!netInfo.decode(payload))	// decode info (views into buffer)
+			{
+				std::cout << "Corrupted info received from " << peer->user.username << std::endl;
+				continue;
+			}
+
+			if (netInfo.type == NetInfoType::rosterRequest)
+				sendQueue.enqueue(laneControl, Routed{ id, makeFrame(payload), NetInfoType::rosterRequest });	// answered by routing thread
+			else										// messages come routed, anything else is not for the server
+				std::cout << "Unexpected " << toString(netInfo.type) << " received from " << peer->user.username << std::endl;
 		}
 
-		std::cout << clients[socketID].username << " left." << std::endl;
-		closesocket(socketID);	// close connection
+		std::cout << peer->user.username << " left." << std::endl;
+		shutdown(socketID, SD_BOTH);	// end connection (socket is closed once no sender worker holds the peer)
 
-		mtx.lock();					// critical section begin
-		sendQueue.enqueue(std::make_pair(0, NetInfo(NetInfoType::clientLeft, clients[socketID].encode()).encode()));	// add client left info to send queue
-		clients.erase(socketID);	// remove user from client list
-		mtx.unlock();				// critical section end
+		presence.leave(peer->user);	// add client left info to send queue (now or with next batch)
+		clients.removeById(id);		// remove user from client list
 	}
 
 	// thread method to handle sending of information
 	void sendMessageThread()
 	{
-		std::pair<int, std::string> data;	// tmp data object to get data
-		while (running)
+		Routed data;						// tmp data object to get data
+		while (sendQueue.waitDequeue(data))	// sleep until data is queued, false once server is closing
 		{
-			if (sendQueue.dequeue(data))	// get data from queue
-			{
-				mtx.lock();														// critical section begin
-				if (data.first == 0)	forwardToAll(data.second);				// broadcast info
-				else					forward(data.first, data.second);		// forward info
-				mtx.unlock();													// critical section end
-			}
+			if (data.type == NetInfoType::rosterRequest)	syncRoster(data.to, *data.frame);						// answer roster request
+			else if (data.to == 0)							forwardToAll(data.frame, classify(data.type));		// broadcast frame
+			else											forward(data.to, data.frame, classify(data.type));	// forward frame
 		}
 	}
 
+	// answer a roster request with roster changes or snapshot pages
+	// runs on the routing thread, so the answer is queued in order with presence broadcasts
+	// (older presence infos reaching the client after it are ignored by version)
+	// _id : user id of requesting client
+	// _request : framed rosterRequest info
+	void syncRoster(int _id, std::string_view _request)
+	{
+		NetInfoView netInfo;
+		RosterRequest request;
+		std::shared_ptr<Peer> receiver;
+		if (!netInfo.decode(_request.substr(FRAME_HEADER_SIZE)) || !request.decode(netInfo.data) || !clients.findById(_id, receiver))
+			return;
+
+		roster.sync(request.version, [&](const std::string& _info) {
+			senders.post(receiver, makeFrame(_info), FrameClass::critical);
+		});
+	}
+
 	// accept client connection
 	// return true if client connected
 	bool accept()
@@ -160,6 +263,7 @@ public:
 
 		if (SocketBase::acceptClient(sock, ip))
 		{
+			setNoDelay(sock);
 			clientThreads.emplace_back(new std::thread(&Server::handleClient, this, sock));	// strat new client thread
 			return true;
 		}
@@ -167,30 +271,34 @@ public:
 		return false;
 	}
 
-	// forward information to given connection
+	// forward frame to given connection's outbound queue
 	// _id: user id of receiver
-	// _data: information to send
-	void forward(const int& _id, std::string _data)
+	// _frame: encoded frame to send
+	// _type: how the frame may be evicted if the receiver can not keep up
+	void forward(const int& _id, const SharedFrame& _frame, FrameClass _type)
 	{
-		std::cout << "Forwarding : " << _data << std::endl;
-		for (auto c = clients.begin(); c != clients.end(); c++)
-			if (c->second.id == _id)
-				sendInfo(c->first, _data);
+		std::shared_ptr<Peer> receiver;
+		if (clients.findById(_id, receiver))						// O(1) lookup, shared lock on one shard
+			senders.post(receiver, _frame, _type);
 	}
 
-	// broadcast information to all connections
-	// _data: information to broadcast
-	void forwardToAll(std::string _data)
+	// broadcast frame to all connections' outbound queues
+	// _frame: encoded frame to broadcast (the same frame is queued for everyone)
+	// _type: how the frame may be evicted if a receiver can not keep up
+	void forwardToAll(const SharedFrame& _frame, FrameClass _type)
 	{
-		std::cout << "Forwarding to all : " << _data << std::endl;
+		std::vector<std::shared_ptr<Peer>> receivers;
+		clients.forEach([&](auto& c) { receivers.push_back(c.conn); });	// shared locks, one shard at a time
 
-		for (auto c = clients.begin(); c != clients.end(); c++)
-			sendInfo(c->first, _data);
+		for (auto& r : receivers)
+			senders.post(r, _frame, _type);
 	}
 
 	~Server()
 	{
 		running = false;
+		presence.stop();	// last presence batch goes out before routing ends
+		sendQueue.close();	// wake send thread
 
 		for (int i = 0; i < clientThreads.size(); i++) // destroy all client threads
 		{
@@ -198,7 +306,10 @@ public:
 			delete clientThreads[i];
 		}
 
-		sendThread->join();	// waut for send thread to join
+		if (sendThread != nullptr)
+			sendThread->join();	// waut for send thread to join
+
+		senders.stop();		// stop sender workers after routing ended
 
 		std::cout << "Server Cleaned" << std::endl;
 	}
@@ -0,0 +1,218 @@
+#pragma once
+
+// minimal io_uring wrapper using raw syscalls (no liburing dependency)
+// only available on linux with kernel headers, HAS_IO_URING is defined when it is
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAS_IO_URING 1
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "../Client/Networking.h"
+
+// send operation owned by a connection while it is in flight
+// (iov and msg must stay valid until its completion is reaped)
+struct UringSend
+{
+	iovec iov[MAX_SEND_BUFFERS];		// frames being sent
+	msghdr msg;							// message header pointing at iov
+};
+
+class Uring
+{
+	int ringID = -1;						// ring file descriptor
+
+	// submission queue
+	unsigned* sqHead = nullptr;
+	unsigned* sqTail = nullptr;
+	unsigned* sqMask = nullptr;
+	unsigned* sqArray = nullptr;
+	io_uring_sqe* sqes = nullptr;
+	unsigned sqLocalTail = 0;				// tail including prepared but unsubmitted entries
+	unsigned toSubmit = 0;					// prepared entries not yet submitted
+
+	// completion queue
+	unsigned* cqHead = nullptr;
+	unsigned* cqTail = nullptr;
+	unsigned* cqMask = nullptr;
+	io_uring_cqe* cqes = nullptr;
+
+	// mapped regions
+	void* sqPtr = nullptr;
+	size_t sqSize = 0;
+	void* cqPtr = nullptr;
+	size_t cqSize = 0;
+	size_t sqesSize = 0;
+	unsigned entries = 0;
+
+public:
+	// create ring
+	// _entries : submission queue size
+	// returns true if io_uring is supported and ring is created
+	bool create(unsigned _entries)
+	{
+		io_uring_params params = {};
+		ringID = (int)syscall(__NR_io_uring_setup, _entries, &params);
+		if (ringID < 0)
+		{
+			std::cerr << "io_uring setup failed with error: " << errno << std::endl;
+			ringID = -1;
+			return false;
+		}
+
+		entries = params.sq_entries;
+		sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+		bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (singleMap)
+			sqSize = cqSize = std::max(sqSize, cqSize);
+
+		sqPtr = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringID, IORING_OFF_SQ_RING);
+		if (sqPtr == MAP_FAILED)
+		{
+			sqPtr = nullptr;
+			destroy();
+			return false;
+		}
+
+		cqPtr = singleMap ? sqPtr : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringID, IORING_OFF_CQ_RING);
+		if (cqPtr == MAP_FAILED)
+		{
+			cqPtr = nullptr;
+			destroy();
+			return false;
+		}
+
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqesPtr = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringID, IORING_OFF_SQES);
+		if (sqesPtr == MAP_FAILED)
+		{
+			destroy();
+			return false;
+		}
+		sqes = (io_uring_sqe*)sqesPtr;
+
+		char* sq = (char*)sqPtr;
+		sqHead = (unsigned*)(sq + params.sq_off.head);
+		sqTail = (unsigned*)(sq + params.sq_off.tail);
+		sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+		sqArray = (unsigned*)(sq + params.sq_off.array);
+		sqLocalTail = *sqTail;
+
+		char* cq = (char*)cqPtr;
+		cqHead = (unsigned*)(cq + params.cq_off.head);
+		cqTail = (unsigned*)(cq + params.cq_off.tail);
+		cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+		cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+		return true;
+	}
+
+	// ring file descriptor (readable when completions are available)
+	int fd() const { return ringID; }
+
+	// prepare a gathered send on a socket
+	// _user : value returned with the completion
+	// returns false if submission queue is full (submit and retry)
+	bool prepSend(int _socketID, UringSend& _send, int _iovCount, uint64_t _user)
+	{
+		unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+		if (sqLocalTail - head >= entries)
+			return false;
+
+		memset(&_send.msg, 0, sizeof(_send.msg));
+		_send.msg.msg_iov = _send.iov;
+		_send.msg.msg_iovlen = _iovCount;
+
+		unsigned index = sqLocalTail & *sqMask;
+		io_uring_sqe* sqe = &sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = _socketID;
+		sqe->addr = (uint64_t)&_send.msg;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = _user;
+
+		sqArray[index] = index;
+		sqLocalTail++;
+		toSubmit++;
+		return true;
+	}
+
+	// submit all prepared entries with a single syscall
+	// returns number of submitted entries or -1 on error
+	int submit()
+	{
+		if (toSubmit == 0)
+			return 0;
+
+		__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+		int submitted = (int)syscall(__NR_io_uring_enter, ringID, toSubmit, 0, 0, nullptr, 0);
+		if (submitted < 0)
+			return -1;
+
+		toSubmit -= submitted;
+		return submitted;
+	}
+
+	// submit prepared entries and block until at least one completion is available
+	// returns false on error (interrupted waits count as done, callers peek and wait again)
+	bool wait()
+	{
+		__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+		int submitted = (int)syscall(__NR_io_uring_enter, ringID, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+		if (submitted < 0)
+			return errno == EINTR;
+
+		toSubmit -= submitted;
+		return true;
+	}
+
+	// take next completion if any
+	// returns false if no completion is available
+	bool peek(uint64_t& _user, int& _result)
+	{
+		unsigned head = *cqHead;
+		if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+			return false;
+
+		io_uring_cqe* cqe = &cqes[head & *cqMask];
+		_user = cqe->user_data;
+		_result = cqe->res;
+
+		__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	// unmap and close ring
+	// buffers of operations still in flight may be used until the kernel tears the ring down,
+	// so owners reap every completion (see wait) before freeing them
+	void destroy()
+	{
+		if (sqes != nullptr)					munmap(sqes, sqesSize);
+		if (cqPtr != nullptr && cqPtr != sqPtr)	munmap(cqPtr, cqSize);
+		if (sqPtr != nullptr)					munmap(sqPtr, sqSize);
+		if (ringID != -1)						close(ringID);
+
+		sqes = nullptr;
+		sqPtr = cqPtr = nullptr;
+		ringID = -1;
+	}
+
+	~Uring()
+	{
+		destroy();
+	}
+};
+
+#endif
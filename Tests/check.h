@@ -0,0 +1,27 @@
+#pragma once
+#include <iostream>
+
+// minimal checks for the behavior tests (one executable per area, run by ctest)
+
+static int checkFailures = 0;	// failed checks of this test executable
+
+// report a failed condition with its location and keep going
+#define CHECK(_cond) \
+	do { \
+		if (!(_cond)) \
+		{ \
+			std::cerr << __FILE__ << ":" << __LINE__ << " check failed : " #_cond << std::endl; \
+			checkFailures++; \
+		} \
+	} while (0)
+
+// print result of a test executable
+// returns process exit code (non zero if a check failed)
+static int checkResult(const char* _name)
+{
+	if (checkFailures == 0)
+		std::cout << _name << " : all checks passed" << std::endl;
+	else
+		std::cout << _name << " : " << checkFailures << " checks failed" << std::endl;
+	return checkFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include "check.h"
+#include "../Server/eventServer.h"
+
+#include <fcntl.h>
+#include <sys/time.h>
+
+// event loop connections on socket pairs: frames reach only the user they are routed to
+
+// one end of a socket pair held by the loop, the other read and written by the test
+struct Pair
+{
+	SOCKET loopEnd = INVALID_SOCKET;
+	SOCKET peer = INVALID_SOCKET;
+	StreamBuffer buffer;			// bytes received by peer
+
+	bool open()
+	{
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+			return false;
+		loopEnd = fds[0];
+		peer = fds[1];
+
+		timeval timeout = { 2, 0 };	// a missing frame fails the test instead of hanging it
+		setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		return setNonBlocking(loopEnd);
+	}
+
+	// returns next information received by peer (empty if none arrived)
+	std::string next()
+	{
+		std::string info;
+		if (!recvInfo(peer, buffer, info))
+			info.clear();
+		return info;
+	}
+
+	// complete the handshake, returns user id given by the server (-1 if none)
+	int handshake(const std::string& _name)
+	{
+		ServerContext sc;
+		if (!sc.decode(next()))
+			return -1;
+		return sendInfo(peer, ClientContext(_name).encode()) ? sc.myId : -1;
+	}
+};
+
+// returns true once _socketID is closed (waits up to two seconds)
+static bool waitClosed(SOCKET _socketID)
+{
+	for (int i = 0; i < 200; i++)
+	{
+		if (fcntl(_socketID, F_GETFD) == -1)
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return false;
+}
+
+static void testReusedSocket()
+{
+	EventServer server;
+	CHECK(server.create() && server.bind(0) && server.start());
+	EventLoop loop(&server);
+	CHECK(loop.start(IoBackend::readiness));
+
+	Pair left;
+	CHECK(left.open());
+	loop.post(left.loopEnd);
+	int leftId = left.handshake("left");
+	CHECK(leftId >= 0);
+	CHECK(!left.next().empty());					// roster snapshot
+
+	closesocket(left.peer);							// user leaves, loop closes its socket
+	CHECK(waitClosed(left.loopEnd));
+
+	Pair reused;
+	CHECK(reused.open());
+	CHECK(reused.loopEnd == left.loopEnd);			// lowest free descriptor is taken again
+	loop.post(reused.loopEnd);
+	ServerContext sc;
+	CHECK(sc.decode(reused.next()));				// adopted, still in handshake
+
+	// private message still queued for the user that left
+	loop.deliver(left.loopEnd, leftId, makeFrame(NetInfo(NetInfoType::message, Message(1, leftId, "stale").encode()).encode()), FrameClass::chat);
+	CHECK(sendInfo(reused.peer, ClientContext("reused").encode()));
+
+	NetInfo info;
+	CHECK(info.decode(reused.next()) && info.type == NetInfoType::rosterSnapshot);	// first frame after the handshake is its own roster
+
+	loop.stop();
+	closesocket(reused.peer);
+}
+
+static void testUnroutedMessage()
+{
+	EventServer server;
+	CHECK(server.create() && server.bind(0) && server.start());
+	EventLoop loop(&server);
+	CHECK(loop.start(IoBackend::readiness));
+
+	Pair sender, receiver;
+	CHECK(sender.open() && receiver.open());
+	loop.post(receiver.loopEnd);
+	int receiverId = receiver.handshake("receiver");
+	CHECK(!receiver.next().empty());				// roster snapshot
+	loop.post(sender.loopEnd);
+	int senderId = sender.handshake("sender");
+	CHECK(!sender.next().empty());
+
+	// message without routing header claiming to come from the receiver itself
+	CHECK(sendInfo(sender.peer, NetInfo(NetInfoType::message, Message(receiverId, receiverId, "spoofed").encode()).encode()));
+
+	std::string routed;
+	encodeRoutedFrame(routed, RouteHeader(NetInfoType::message, senderId, receiverId), NetInfo(NetInfoType::message, Message(senderId, receiverId, "routed").encode()).encode());
+	CHECK(sendFrame(sender.peer, routed));
+
+	NetInfo info;
+	Message msg;
+	CHECK(info.decode(receiver.next()) && info.type == NetInfoType::message);
+	CHECK(msg.decode(info.data) && msg.from == senderId && msg.data == "routed");		// spoofed message was dropped
+
+	loop.stop();
+	closesocket(sender.peer);
+	closesocket(receiver.peer);
+}
+
+int main()
+{
+	InitWinSock();
+	testReusedSocket();
+	testUnroutedMessage();
+	return checkResult("event loop");
+}
@@ -0,0 +1,109 @@
+#include "check.h"
+#include "../Client/Networking.h"
+
+#include <cstring>
+#include <vector>
+
+// frame parsing from a StreamBuffer however the stream is cut by the network
+
+// returns a stream of frames carrying payloads of growing size (empty one included)
+static std::string stream(std::vector<std::string>& _payloads)
+{
+	std::string out;
+	for (size_t i = 0; i < 12; i++)
+	{
+		_payloads.push_back(std::string(i * i * 37, char('a' + i)));
+		encodeFrame(out, _payloads.back(), i % 2 ? frameRouted : frameInfo);
+	}
+	return out;
+}
+
+// feed _stream into a buffer in chunks of _chunk bytes and return every payload taken from it
+static std::vector<std::string> parse(const std::string& _stream, size_t _chunk)
+{
+	StreamBuffer buffer(16);			// small, so prepare has to move and grow
+	std::vector<std::string> payloads;
+	FrameHeader header;
+	std::string_view payload;
+	bool corrupted;
+
+	for (size_t pos = 0; pos < _stream.size(); pos += _chunk)
+	{
+		size_t size = _stream.size() - pos < _chunk ? _stream.size() - pos : _chunk;
+		memcpy(buffer.prepare(size), _stream.data() + pos, size);
+		buffer.commit(size);
+
+		while (buffer.nextFrame(header, payload, corrupted))
+			payloads.emplace_back(payload);
+		CHECK(!corrupted);
+	}
+	return payloads;
+}
+
+static void testChunks()
+{
+	std::vector<std::string> payloads;
+	std::string frames = stream(payloads);
+
+	CHECK(parse(frames, 1) == payloads);						// one byte at a time
+	CHECK(parse(frames, frames.size()) == payloads);			// every frame in one chunk
+	CHECK(parse(frames, 7) == payloads);						// cuts inside and across headers
+	CHECK(parse(frames, RECV_CHUNK_SIZE) == payloads);
+}
+
+static void testSplitHeader()
+{
+	std::string frame;
+	encodeFrame(frame, "split header");
+	encodeFrame(frame, "next");
+
+	for (size_t cut = 1; cut < FRAME_HEADER_SIZE; cut++)
+	{
+		StreamBuffer buffer;
+		FrameHeader header;
+		std::string_view payload;
+		bool corrupted;
+
+		memcpy(buffer.prepare(cut), frame.data(), cut);
+		buffer.commit(cut);
+		CHECK(!buffer.nextFrame(header, payload, corrupted) && !corrupted);	// header not complete yet
+
+		size_t rest = frame.size() - cut;
+		memcpy(buffer.prepare(rest), frame.data() + cut, rest);
+		buffer.commit(rest);
+		CHECK(buffer.nextFrame(header, payload, corrupted) && payload == "split header" && header.type == frameInfo);
+		CHECK(buffer.nextFrame(header, payload, corrupted) && payload == "next");
+		CHECK(!buffer.nextFrame(header, payload, corrupted) && !corrupted);
+	}
+}
+
+static void testOversize()
+{
+	FrameHeader big;
+	big.length = MAX_FRAME_SIZE + 1;
+	char bytes[FRAME_HEADER_SIZE];
+	big.write(bytes);
+
+	StreamBuffer buffer;
+	FrameHeader header;
+	std::string_view payload;
+	bool corrupted;
+	memcpy(buffer.prepare(FRAME_HEADER_SIZE), bytes, FRAME_HEADER_SIZE);
+	buffer.commit(FRAME_HEADER_SIZE);
+	CHECK(!buffer.nextFrame(header, payload, corrupted) && corrupted);	// flagged before any payload arrives
+
+	big.length = MAX_FRAME_SIZE;								// largest allowed, waits for its payload
+	big.write(bytes);
+	StreamBuffer waiting;
+	memcpy(waiting.prepare(FRAME_HEADER_SIZE), bytes, FRAME_HEADER_SIZE);
+	waiting.commit(FRAME_HEADER_SIZE);
+	CHECK(!waiting.nextFrame(header, payload, corrupted) && !corrupted);
+}
+
+int main()
+{
+	testChunks();
+	testSplitHeader();
+	testOversize();
+	return checkResult("framing");
+}
@@ -0,0 +1,99 @@
+#include "check.h"
+#include "../Server/inbound.h"
+
+#include <random>
+
+// UTF-8 validation against the scalar reference, control character handling
+
+// scalar reference for the whole text
+static bool scalarUtf8(const std::string& _text)
+{
+	return validUtf8Scalar((const unsigned char*)_text.data(), _text.size(), 0, _text.size()) <= _text.size();
+}
+
+// random text that is mostly valid UTF-8 (ascii runs and sequences of every length) with occasional damage
+static std::string randomText(std::mt19937& _rng)
+{
+	static const char* pieces[] = { "a", "hello ", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\xED\x9F\xBF", "\xF4\x8F\xBF\xBF", "\t\n" };
+	std::string text;
+	size_t length = _rng() % 80;
+	while (text.size() < length)
+		text += pieces[_rng() % 8];
+
+	switch (_rng() % 4)
+	{
+	case 0: break;														// valid
+	case 1: if (!text.empty()) text[_rng() % text.size()] = char(_rng()); break;	// one random byte
+	case 2: if (!text.empty()) text.resize(_rng() % text.size()); break;			// cut, maybe inside a sequence
+	case 3: text.insert(_rng() % (text.size() + 1), 1, char(0x80 | (_rng() & 0x7F))); break;	// stray byte
+	}
+	return text;
+}
+
+static void testKnownSequences()
+{
+	CHECK(validUtf8(""));
+	CHECK(validUtf8("plain ascii that is longer than sixteen bytes"));
+	CHECK(validUtf8("h\xC3\xA9llo \xF0\x9F\x98\x80 and some more text to fill a block"));
+	CHECK(validUtf8("\xEF\xBF\xBF\xF4\x8F\xBF\xBF"));						// U+FFFF, U+10FFFF
+
+	const char* invalid[] = {
+		"\xC0\xAF",					// overlong 2 byte
+		"\xE0\x80\xAF",				// overlong 3 byte
+		"\xF0\x80\x80\xAF",			// overlong 4 byte
+		"\xED\xA0\x80",				// surrogate
+		"\xF4\x90\x80\x80",			// above U+10FFFF
+		"\xF5\x80\x80\x80",			// invalid lead
+		"\x80",						// stray continuation
+		"\xE2\x82",					// truncated
+	};
+	for (const char* s : invalid)
+	{
+		CHECK(!validUtf8(s));
+		std::string padded = std::string(20, 'x') + s + std::string(20, 'y');	// inside a simd block
+		CHECK(!validUtf8(padded));
+		CHECK(!validUtf8(std::string(31, 'z') + s));							// across a block boundary
+	}
+}
+
+static void testAgainstScalar()
+{
+	std::mt19937 rng(2024);
+	size_t mismatches = 0;
+	for (int i = 0; i < 200000; i++)
+	{
+		std::string text = randomText(rng);
+		if (validUtf8(text) != scalarUtf8(text))
+			mismatches++;
+	}
+	CHECK(mismatches == 0);
+
+	for (int i = 0; i < 100000; i++)				// raw random bytes
+	{
+		std::string text(rng() % 48, '\0');
+		for (auto& c : text)
+			c = char(rng());
+		if (validUtf8(text) != scalarUtf8(text))
+			mismatches++;
+	}
+	CHECK(mismatches == 0);
+}
+
+static void testControls()
+{
+	CHECK(!hasControls("tab\tand\nnew line stay, so does \xC2\xA0 (nbsp)"));
+	CHECK(hasControls("bell\x07"));
+	CHECK(hasControls("del\x7F"));
+	CHECK(hasControls("c1 \xC2\x85 next line"));
+	CHECK(hasControls(std::string(40, 'a') + "\x1B[31m"));		// escape after a clean simd block
+
+	CHECK(stripControls("a\x07" "b\tc\x7F" "d\xC2\x85" "e\xC2\xA0") == "ab\tcde\xC2\xA0");
+}
+
+int main()
+{
+	testKnownSequences();
+	testAgainstScalar();
+	testControls();
+	return checkResult("inbound");
+}
@@ -0,0 +1,178 @@
+#include "check.h"
+#include "../Server/outbound.h"
+
+#include <thread>
+
+// outbound queue limits, eviction order and partial writes, batch packing
+
+// frame carrying a message info with _text
+static SharedFrame chatFrame(const std::string& _text)
+{
+	return makeFrame(NetInfo(NetInfoType::message, Message(1, 0, _text).encode()).encode());
+}
+
+// frame carrying a presence info
+static SharedFrame presenceFrame(unsigned int _id)
+{
+	return makeFrame(NetInfo(NetInfoType::clientJoined, RosterChange(_id, true, User(_id, "u")).encode()).encode());
+}
+
+// returns every queued frame in order (as gathered for a write)
+static std::vector<std::string> queued(const OutboundQueue& _queue)
+{
+	std::string_view buffers[MAX_SEND_BUFFERS];
+	size_t count = _queue.gather(buffers, MAX_SEND_BUFFERS);
+	return std::vector<std::string>(buffers, buffers + count);
+}
+
+static void testEvictOldestChat()
+{
+	OutboundLimits limits;
+	limits.maxFrames = 4;
+	OutboundStats stats;
+	OutboundQueue queue;
+
+	SharedFrame context = makeFrame("context");
+	CHECK(queue.push(context, FrameClass::critical, limits, stats));
+	for (int i = 0; i < 6; i++)
+		CHECK(queue.push(chatFrame("m" + std::to_string(i)), FrameClass::chat, limits, stats));
+
+	auto frames = queued(queue);
+	CHECK(frames.size() == 4);						// oldest messages made room, critical kept
+	CHECK(frames[0] == *context);
+	CHECK(frames[1] == *chatFrame("m3") && frames[3] == *chatFrame("m5"));
+	CHECK(stats.droppedMessages == 3);
+
+	size_t bytes = 0;
+	for (auto& f : frames)
+		bytes += f.size();
+	CHECK(queue.byteSize() == bytes);
+}
+
+static void testPresenceKeptByDefault()
+{
+	OutboundLimits limits;
+	limits.maxFrames = 2;
+	limits.grace = std::chrono::milliseconds(0);	// over limits after eviction disconnects at once
+	OutboundStats stats;
+	OutboundQueue queue;
+
+	CHECK(queue.push(presenceFrame(1), FrameClass::presence, limits, stats));
+	CHECK(queue.push(presenceFrame(2), FrameClass::presence, limits, stats));
+	CHECK(!queue.push(presenceFrame(3), FrameClass::presence, limits, stats));	// nothing may be evicted
+	CHECK(stats.disconnects == 1 && stats.droppedPresence == 0);
+
+	limits.dropPresence = true;
+	OutboundQueue dropping;
+	CHECK(dropping.push(presenceFrame(1), FrameClass::presence, limits, stats));
+	CHECK(dropping.push(presenceFrame(2), FrameClass::presence, limits, stats));
+	CHECK(dropping.push(presenceFrame(3), FrameClass::presence, limits, stats));
+	CHECK(dropping.size() == 2 && stats.droppedPresence == 1);
+}
+
+static void testGrace()
+{
+	OutboundLimits limits;
+	limits.maxBytes = 10;
+	limits.grace = std::chrono::milliseconds(20);
+	OutboundStats stats;
+	OutboundQueue queue;
+
+	SharedFrame big = makeFrame(std::string(64, 'x'));
+	CHECK(queue.push(big, FrameClass::critical, limits, stats));		// over limits, grace starts
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	CHECK(!queue.push(big, FrameClass::critical, limits, stats));		// still over after grace
+	CHECK(stats.overLimit == 2 && stats.disconnects == 1);
+}
+
+static void testPartialWrites()
+{
+	OutboundLimits limits;
+	limits.maxFrames = 3;
+	OutboundStats stats;
+	OutboundQueue queue;
+
+	SharedFrame first = chatFrame("first");
+	queue.push(first, FrameClass::chat, limits, stats);
+	queue.push(chatFrame("second"), FrameClass::chat, limits, stats);
+	queue.consume(3);									// first frame partly written
+
+	queue.push(chatFrame("third"), FrameClass::chat, limits, stats);
+	queue.push(chatFrame("fourth"), FrameClass::chat, limits, stats);	// evicts second, never the partly written one
+
+	auto frames = queued(queue);
+	CHECK(frames.size() == 3);
+	CHECK(frames[0] == first->substr(3));
+	CHECK(frames[1] == *chatFrame("third"));
+
+	queue.pin(2);										// in flight write, pinned frames stay
+	queue.push(chatFrame("fifth"), FrameClass::chat, limits, stats);
+	frames = queued(queue);
+	CHECK(frames.size() == 3 && frames[1] == *chatFrame("third") && frames[2] == *chatFrame("fifth"));
+	queue.pin(0);
+
+	size_t total = queue.byteSize();
+	queue.consume(total);
+	CHECK(queue.empty() && queue.byteSize() == 0);
+}
+
+static void testPrepareBatches()
+{
+	OutboundLimits limits;
+	OutboundStats stats;
+	OutboundQueue queue;
+	BatchPacker packer;
+
+	std::vector<std::string> infos;
+	for (int i = 0; i < 5; i++)
+	{
+		infos.push_back(NetInfo(NetInfoType::message, Message(1, 0, "m" + std::to_string(i)).encode()).encode());
+		queue.push(makeFrame(infos.back()), FrameClass::chat, limits, stats);
+	}
+	queue.push(presenceFrame(9), FrameClass::presence, limits, stats);
+
+	queue.prepare(&packer, nullptr);
+	CHECK(queue.size() == 1 && queue.infos(1) == 6);
+	CHECK(packer.batches == 1 && packer.packed == 6);
+
+	auto frames = queued(queue);
+	FrameHeader header;
+	CHECK(header.read(frames[0].data()) && header.length == frames[0].size() - FRAME_HEADER_SIZE);
+
+	NetInfoView info;
+	InfoBatchView batch;
+	CHECK(info.decode(std::string_view(frames[0]).substr(FRAME_HEADER_SIZE)) && info.type == NetInfoType::batch);
+	CHECK(batch.decode(info.data) && batch.infos.size() == 6);
+	for (size_t i = 0; i < infos.size(); i++)
+		CHECK(batch.infos[i] == infos[i]);
+	CHECK(queue.byteSize() == frames[0].size());
+}
+
+static void testBatchFrameEncoding()
+{
+	// one pass writer must match the schema codec for any number and size of informations
+	for (size_t count : { 0, 1, 2, 40 })
+	{
+		std::vector<std::string> infos;
+		std::vector<std::string_view> views;
+		for (size_t i = 0; i < count; i++)
+			infos.push_back(NetInfo(NetInfoType::message, Message(1, 0, std::string(i * 7, 'x')).encode()).encode());
+		for (auto& i : infos)
+			views.push_back(i);
+
+		std::string data;
+		InfoBatchView{ views }.encode(data);
+		CHECK(*makeBatchFrame(views) == *makeFrame(NetInfo(NetInfoType::batch, data).encode()));
+	}
+}
+
+int main()
+{
+	testEvictOldestChat();
+	testPresenceKeptByDefault();
+	testGrace();
+	testPartialWrites();
+	testPrepareBatches();
+	testBatchFrameEncoding();
+	return checkResult("outbound");
+}
@@ -0,0 +1,161 @@
+#include "check.h"
+#include "../Client/MessageQueue.h"
+
+#include <thread>
+#include <vector>
+
+// stress of the lock-free queues: nothing lost, duplicated or reordered per producer
+
+constexpr int PRODUCERS = 4;
+constexpr uint64_t ITEMS = 200000;	// per producer
+
+// item carrying its producer and sequence number
+static uint64_t item(int _producer, uint64_t _seq)
+{
+	return (uint64_t(_producer) << 32) | _seq;
+}
+
+static void testMsgQueue()
+{
+	MsgQueue<uint64_t> queue(64);		// small pool so nodes are recycled and reallocated
+
+	std::vector<std::thread> producers;
+	for (int p = 0; p < PRODUCERS; p++)
+		producers.emplace_back([&queue, p] {
+			for (uint64_t i = 0; i < ITEMS; i++)
+				queue.enqueue(item(p, i));
+		});
+
+	std::vector<uint64_t> next(PRODUCERS, 0);	// next sequence number expected from each producer
+	bool ordered = true;
+	uint64_t received = 0;
+	std::vector<uint64_t> all;
+	while (received < PRODUCERS * ITEMS)
+	{
+		all.clear();
+		if (received % 2 == 0)
+		{
+			uint64_t one;
+			if (queue.waitDequeue(one, std::chrono::microseconds(1000)))
+				all.push_back(one);
+		}
+		else
+			queue.dequeueAll(all);
+
+		for (uint64_t v : all)
+		{
+			int p = int(v >> 32);
+			ordered = ordered && p < PRODUCERS && (v & 0xFFFFFFFF) == next[p];
+			if (p < PRODUCERS)
+				next[p]++;
+			received++;
+		}
+	}
+
+	for (auto& t : producers)
+		t.join();
+
+	CHECK(ordered);
+	CHECK(received == PRODUCERS * ITEMS);
+	CHECK(queue.isNull());
+
+	uint64_t left;
+	queue.close();								// closed and empty, waits return at once
+	CHECK(!queue.waitDequeue(left));
+	queue.enqueue(1);							// still usable after close
+	CHECK(queue.waitDequeue(left) && left == 1);
+}
+
+static void testSpscRing()
+{
+	SpscRing<uint64_t> ring(60);
+	CHECK(ring.capacity() == 64);
+
+	std::thread producer([&ring] {
+		uint64_t batch[7];
+		for (uint64_t i = 0; i < ITEMS;)
+		{
+			if (i % 3 == 0)						// single pushes and batches
+			{
+				if (ring.push(i))
+					i++;
+				else
+					std::this_thread::yield();
+				continue;
+			}
+
+			size_t count = 0;
+			for (; count < 7 && i + count < ITEMS; count++)
+				batch[count] = i + count;
+			size_t pushed = ring.pushBatch(batch, count);
+			i += pushed;
+			if (pushed == 0)
+				std::this_thread::yield();
+		}
+		ring.close();							// consumer stops once drained
+	});
+
+	uint64_t expected = 0;
+	bool ordered = true;
+	std::vector<uint64_t> all;
+	while (ring.waitPopAll(all))
+	{
+		CHECK(all.size() <= ring.capacity());
+		for (uint64_t v : all)
+			ordered = ordered && v == expected++;
+		all.clear();
+	}
+	producer.join();
+
+	std::vector<uint64_t> rest;					// close raced with the last pops
+	ring.popAll(rest);
+	for (uint64_t v : rest)
+		ordered = ordered && v == expected++;
+
+	CHECK(ordered);
+	CHECK(expected == ITEMS);
+	CHECK(ring.empty());
+}
+
+static void testSpscRingFull()
+{
+	SpscRing<int> ring(4);
+	for (int i = 0; i < 4; i++)
+		CHECK(ring.push(i));
+	CHECK(ring.full());
+	CHECK(!ring.push(9));						// full, nothing taken
+
+	int first;
+	CHECK(ring.pop(first) && first == 0);
+	CHECK(ring.push(4));
+
+	std::vector<int> all;
+	CHECK(ring.popAll(all) && all == std::vector<int>({ 1, 2, 3, 4 }));
+	CHECK(!ring.popAll(all));
+}
+
+static void testMutexQueue()
+{
+	MutexQueue<int> queue;
+	std::vector<std::thread> producers;
+	for (int p = 0; p < PRODUCERS; p++)
+		producers.emplace_back([&queue] {
+			for (int i = 0; i < 10000; i++)
+				queue.enqueue(i);
+		});
+	for (auto& t : producers)
+		t.join();
+
+	std::vector<int> all;
+	queue.dequeueAll(all);
+	CHECK(all.size() == size_t(PRODUCERS) * 10000);
+}
+
+int main()
+{
+	testMsgQueue();
+	testSpscRing();
+	testSpscRingFull();
+	testMutexQueue();
+	return checkResult("queues");
+}
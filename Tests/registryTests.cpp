@@ -0,0 +1,151 @@
+#include "check.h"
+#include "../Server/registry.h"
+
+#include <random>
+#include <string>
+#include <unordered_map>
+
+// FlatMap and ConnectionRegistry against std::unordered_map under random inserts, erases and lookups
+
+// home slot of a key in a FlatMap of _capacity slots (same hash as FlatMap::home)
+static size_t homeSlot(int _key, size_t _capacity)
+{
+	return size_t((uint64_t(_key) * 0x9E3779B97F4A7C15ull) >> 32) & (_capacity - 1);
+}
+
+// returns true if _map holds exactly the keys of _reference (keys looked up from _keys)
+static bool same(FlatMap<int, int>& _map, const std::unordered_map<int, int>& _reference, const std::vector<int>& _keys)
+{
+	if (_map.size() != _reference.size())
+		return false;
+
+	for (int k : _keys)
+	{
+		int* value = _map.find(k);
+		auto r = _reference.find(k);
+		if ((value == nullptr) != (r == _reference.end()) || (value != nullptr && *value != r->second))
+			return false;
+	}
+	return true;
+}
+
+// random operations on _map and _reference with keys from _keys, at most _maxSize keys held
+// returns number of operations after which the maps differed
+static size_t randomOps(FlatMap<int, int>& _map, std::unordered_map<int, int>& _reference, const std::vector<int>& _keys, size_t _maxSize, std::mt19937& _rng)
+{
+	size_t mismatches = 0;
+	for (int i = 0; i < 100000; i++)
+	{
+		int key = _keys[_rng() % _keys.size()];
+		switch (_rng() % 3)
+		{
+		case 0:
+			if (_reference.size() < _maxSize || _reference.count(key))
+			{
+				_map.set(key, i);
+				_reference[key] = i;
+			}
+			break;
+		case 1:
+			if (_map.erase(key) != (_reference.erase(key) == 1))
+				mismatches++;
+			break;
+		case 2:
+			break;			// lookups only
+		}
+
+		if (!same(_map, _reference, _keys))
+			mismatches++;
+	}
+	return mismatches;
+}
+
+static void testFlatMapCollisions()
+{
+	// keys sharing the last slots of a 16 slot table, so probes wrap around to the front
+	std::vector<int> keys;
+	for (int k = 1; keys.size() < 24; k++)
+	{
+		size_t home = homeSlot(k, 16);
+		if (home >= 14 || home <= 1)
+			keys.push_back(k);
+	}
+
+	std::mt19937 rng(14);
+	FlatMap<int, int> map;
+	std::unordered_map<int, int> reference;
+	CHECK(randomOps(map, reference, keys, 12, rng) == 0);		// 12 keys stay under 3/4 load, the table never grows
+	CHECK(map.find(0) == nullptr && !map.erase(0));
+}
+
+static void testFlatMapGrowth()
+{
+	std::vector<int> keys;
+	for (int k = 1; k <= 3000; k++)
+		keys.push_back(k * 7);
+
+	std::mt19937 rng(41);
+	FlatMap<int, int> map;
+	std::unordered_map<int, int> reference;
+	for (int k : keys)											// grows through several capacities
+		if (rng() % 2)
+		{
+			map.set(k, k);
+			reference[k] = k;
+		}
+	CHECK(same(map, reference, keys));
+
+	std::vector<int> some(keys.begin(), keys.begin() + 64);		// random work on part of a large table
+	CHECK(randomOps(map, reference, some, keys.size(), rng) == 0);
+	CHECK(same(map, reference, keys));
+}
+
+static void testConnectionRegistry()
+{
+	ConnectionRegistry<std::string> registry;
+	std::unordered_map<int, std::string> reference;
+	std::mt19937 rng(7);
+	size_t mismatches = 0;
+
+	for (int i = 0; i < 50000; i++)
+	{
+		int id = int(rng() % 200);
+		if (rng() % 2)
+		{
+			std::string conn = std::to_string(id) + "/" + std::to_string(i);
+			registry.add(id, SOCKET(id + 1000), conn);			// replaces a registered id
+			reference[id] = conn;
+		}
+		else if (registry.removeById(id) != (reference.erase(id) == 1))
+			mismatches++;
+
+		std::string* found = registry.findById(id);
+		auto r = reference.find(id);
+		if ((found == nullptr) != (r == reference.end()) || (found != nullptr && *found != r->second))
+			mismatches++;
+	}
+	CHECK(mismatches == 0);
+	CHECK(registry.size() == reference.size());
+
+	// every entry moved by a swap remove is still found by id
+	size_t walked = 0;
+	for (auto& e : registry)
+	{
+		walked++;
+		CHECK(reference.count(e.id) && reference[e.id] == e.conn && e.socketID == SOCKET(e.id + 1000));
+		CHECK(registry.findById(e.id) == &e.conn);
+	}
+	CHECK(walked == reference.size());
+
+	for (auto& r : reference)
+		CHECK(registry.removeById(r.first));
+	CHECK(registry.size() == 0 && registry.begin() == registry.end());
+}
+
+int main()
+{
+	testFlatMapCollisions();
+	testFlatMapGrowth();
+	testConnectionRegistry();
+	return checkResult("registry");
+}
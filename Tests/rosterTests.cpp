@@ -0,0 +1,198 @@
+#include "check.h"
+#include "../Server/roster.h"
+
+#include <map>
+
+// roster sync: snapshot pages and change sets bring a client to the server's user list
+
+// user list held by a client, updated from roster infos the way the client applies them
+struct ClientRoster
+{
+	uint64_t version = 0;
+	std::map<unsigned int, std::string> users;
+	std::map<unsigned int, std::string> pending;	// snapshot pages received so far
+	size_t snapshots = 0;							// snapshot infos received
+	size_t changeSets = 0;							// rosterChanges infos received
+
+	void apply(const RosterChange& _change)
+	{
+		if (_change.version <= version)
+			return;
+		if (_change.joined)
+			users[_change.user.id] = _change.user.username;
+		else
+			users.erase(_change.user.id);
+		version = _change.version;
+	}
+
+	void receive(const std::string& _info)
+	{
+		NetInfoView info;
+		CHECK(info.decode(_info));
+		switch (info.type)
+		{
+		case NetInfoType::clientJoined:
+		case NetInfoType::clientLeft:
+		{
+			RosterChange change;
+			CHECK(change.decode(info.data));
+			apply(change);
+			break;
+		}
+		case NetInfoType::rosterChanges:
+		{
+			RosterChanges delta;
+			CHECK(delta.decode(info.data));
+			CHECK(delta.from <= version);			// never a gap for a client that kept up
+			for (auto& c : delta.changes)
+				apply(c);
+			if (delta.to > version)
+				version = delta.to;
+			changeSets++;
+			break;
+		}
+		case NetInfoType::rosterSnapshot:
+		{
+			RosterSnapshot page;
+			CHECK(page.decode(info.data));
+			if (page.first == 0)
+				pending.clear();
+			for (auto& u : page.users)
+				pending[u.id] = u.username;
+			if (page.last())
+			{
+				users.swap(pending);
+				pending.clear();
+				version = page.version;
+			}
+			snapshots++;
+			break;
+		}
+		default:
+			CHECK(false);
+		}
+	}
+};
+
+// returns callback feeding infos to _client
+static auto to(ClientRoster& _client)
+{
+	return [&_client](const std::string& _info) { _client.receive(_info); };
+}
+
+static void testSnapshotPages()
+{
+	Roster roster;
+	ClientRoster live;
+	for (unsigned int id = 1; id <= ROSTER_PAGE_SIZE * 2 + 10; id++)
+		roster.join(User(id, "user" + std::to_string(id)), to(live));
+
+	ClientRoster fresh;
+	roster.sync(0, to(fresh));
+	CHECK(fresh.snapshots == 3);							// pages of ROSTER_PAGE_SIZE users
+	CHECK(fresh.users == live.users && fresh.version == roster.currentVersion());
+	CHECK(live.version == roster.currentVersion());
+
+	ClientRoster empty;
+	Roster none;
+	none.sync(0, to(empty));
+	CHECK(empty.snapshots == 1 && empty.users.empty() && empty.version == none.currentVersion());
+}
+
+static void testChangesSince()
+{
+	Roster roster;
+	ClientRoster live;
+	for (unsigned int id = 1; id <= 20; id++)
+		roster.join(User(id, "u"), to(live));
+
+	ClientRoster returning;
+	roster.sync(0, to(returning));
+	uint64_t known = returning.version;
+
+	roster.leave(User(3, "u"), to(live));
+	roster.join(User(21, "u"), to(live));
+	roster.join(User(22, "u"), to(live));
+	roster.leave(User(22, "u"), to(live));					// joined and left while away, left out
+
+	returning.snapshots = 0;
+	roster.sync(known, to(returning));
+	CHECK(returning.snapshots == 0 && returning.changeSets == 1);
+	CHECK(returning.users == live.users && returning.version == roster.currentVersion());
+
+	ClientRoster current;
+	current.version = roster.currentVersion();
+	current.users = live.users;
+	roster.sync(current.version, to(current));				// up to date, empty change set
+	CHECK(current.changeSets == 1 && current.users == live.users);
+}
+
+static void testLogOverflow()
+{
+	Roster roster;
+	ClientRoster live;
+	roster.join(User(1, "u"), to(live));
+
+	ClientRoster stale;
+	roster.sync(0, to(stale));
+	uint64_t known = stale.version;
+
+	for (size_t i = 0; i < ROSTER_LOG_SIZE; i++)			// more changes than the log holds
+	{
+		roster.join(User(2, "u"), to(live));
+		roster.leave(User(2, "u"), to(live));
+	}
+
+	stale.snapshots = 0;
+	roster.sync(known, to(stale));
+	CHECK(stale.snapshots == 1 && stale.changeSets == 0);
+	CHECK(stale.users == live.users && stale.version == roster.currentVersion());
+
+	ClientRoster future;
+	roster.sync(roster.currentVersion() + 5, to(future));	// version of another server run
+	CHECK(future.snapshots == 1);
+}
+
+static void testBatching()
+{
+	Roster roster;
+	roster.setBatching(true);
+
+	ClientRoster live;
+	roster.sync(0, to(live));
+	size_t published = 0;
+	auto publish = [&](const std::string& _info) { published++; live.receive(_info); };
+
+	CHECK(!roster.flush(publish));							// nothing changed
+	roster.join(User(1, "a"), publish);
+	roster.join(User(2, "b"), publish);
+	roster.join(User(3, "c"), publish);
+	roster.leave(User(2, "b"), publish);					// joined and left between flushes, left out
+	CHECK(published == 0);
+
+	CHECK(roster.flush(publish));
+	CHECK(published == 1 && live.changeSets == 1);
+	CHECK(live.users.size() == 2 && live.users.count(1) && live.users.count(3));
+	CHECK(live.version == roster.currentVersion());
+
+	// a client synced between flushes already knows the join, it must still get the leave
+	roster.join(User(4, "d"), publish);
+	ClientRoster synced;
+	roster.sync(0, to(synced));
+	CHECK(synced.users.count(4));
+	roster.leave(User(4, "d"), publish);
+
+	auto both = [&](const std::string& _info) { live.receive(_info); synced.receive(_info); };
+	CHECK(roster.flush(both));
+	CHECK(!synced.users.count(4) && synced.users == live.users);
+	CHECK(synced.version == roster.currentVersion() && live.version == roster.currentVersion());
+}
+
+int main()
+{
+	testSnapshotPages();
+	testChangesSince();
+	testLogOverflow();
+	testBatching();
+	return checkResult("roster");
+}
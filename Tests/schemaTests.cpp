@@ -0,0 +1,129 @@
+#include "check.h"
+#include "../Client/NetworkData.h"
+
+// round trips of every wire struct, versioned fields and corrupted input
+
+static void testVarints()
+{
+	for (uint64_t v : { uint64_t(0), uint64_t(1), uint64_t(127), uint64_t(128), uint64_t(300), uint64_t(1) << 35, ~uint64_t(0) })
+	{
+		std::string out;
+		putVarint(out, v);
+		CHECK(out.size() == varintSize(v));
+
+		std::string_view in(out);
+		uint64_t back;
+		CHECK(getVarint(in, back) && back == v && in.empty());
+	}
+
+	std::string_view truncated("\x80\x80", 2);	// continuation bit set on the last byte
+	uint64_t value;
+	CHECK(!getVarint(truncated, value));
+
+	// small negatives stay short
+	CHECK(toWire(-1) == 1 && fromWire<int>(toWire(-1)) == -1);
+	CHECK(fromWire<int>(toWire(-123456)) == -123456);
+}
+
+static void testNetInfoType()
+{
+	// every compiler sends the type as its plain value (one byte), peekType reads it back
+	for (NetInfoType t : { Null, clientLeft, clientJoined, message, rosterChanges, batch })
+	{
+		std::string info = NetInfo(t, "x").encode();
+		CHECK(uint8_t(info[0]) == uint8_t(t));
+		CHECK(peekType(info) == t);
+	}
+	CHECK(peekType(std::string_view()) == Null);
+}
+
+static void testRoundTrips()
+{
+	Message msg(7, -3, std::string("h\0llo \xC3\xA9", 8));
+	Message msgBack;
+	CHECK(msgBack.decode(msg.encode()) && msgBack.from == 7 && msgBack.to == -3 && msgBack.data == msg.data);
+
+	std::string info = NetInfo(NetInfoType::message, msg.encode()).encode();
+	NetInfoView view;
+	MessageView msgView;
+	CHECK(view.decode(info) && view.type == NetInfoType::message && msgView.decode(view.data));
+	CHECK(msgView.from == 7 && msgView.to == -3 && msgView.data == msg.data);
+
+	RosterChanges delta;
+	delta.from = 10;
+	delta.to = 12;
+	delta.changes = { RosterChange(11, true, User(5, "ann")), RosterChange(12, false, User(6, "bob")) };
+	RosterChanges deltaBack;
+	CHECK(deltaBack.decode(delta.encode()) && deltaBack.from == 10 && deltaBack.to == 12 && deltaBack.changes.size() == 2);
+	CHECK(deltaBack.changes[0].joined && deltaBack.changes[0].user.username == "ann" && !deltaBack.changes[1].joined);
+	CHECK(deltaBack.changes[1].version == 12 && deltaBack.changes[1].user.id == 6);
+
+	RosterSnapshot page;
+	page.version = 99;
+	page.total = 3;
+	page.first = 1;
+	page.users = { User(1, "a"), User(2, "b") };
+	RosterSnapshot pageBack;
+	CHECK(pageBack.decode(page.encode()) && pageBack.version == 99 && pageBack.users.size() == 2 && pageBack.last());
+
+	std::string a = NetInfo(NetInfoType::message, "one").encode(), b = NetInfo(NetInfoType::clientLeft, "two").encode();
+	InfoBatchView batch{ { a, b } };
+	std::string encoded;
+	batch.encode(encoded);
+	InfoBatchView batchBack;
+	CHECK(batchBack.decode(encoded) && batchBack.infos.size() == 2 && batchBack.infos[0] == a && batchBack.infos[1] == b);
+}
+
+static void testVersions()
+{
+	ClientContext cc("carol", 42, featureBatch | featureCompression);
+	ClientContext ccBack;
+	CHECK(ccBack.decode(cc.encode()) && ccBack.username == "carol" && ccBack.rosterVersion == 42 && ccBack.features == (featureBatch | featureCompression));
+
+	// version 0 writer: only the name, newer fields default
+	std::string old;
+	putBytes(old, "dave");
+	CHECK(ccBack.decode(old) && ccBack.username == "dave" && ccBack.rosterVersion == 0 && ccBack.features == 0);
+
+	// newer writer: bytes after the known fields are ignored
+	std::string newer = cc.encode();
+	putVarint(newer, 77);
+	CHECK(ccBack.decode(newer) && ccBack.username == "carol");
+
+	ServerContext sc(3, 1000, 0xABCD);
+	ServerContext scBack;
+	CHECK(scBack.decode(sc.encode()) && scBack.myId == 3 && scBack.rosterVersion == 1000 && scBack.dictionaryId == 0xABCD);
+
+	// a missing version 0 field is corrupted
+	ServerContext empty;
+	CHECK(!empty.decode(std::string_view()));
+}
+
+static void testCorrupted()
+{
+	std::string msg = Message(1, 2, "hello").encode();
+	for (size_t cut = 0; cut < msg.size(); cut++)
+	{
+		Message back;
+		CHECK(!back.decode(std::string_view(msg).substr(0, cut)));
+	}
+
+	std::string huge;
+	putVarint(huge, 1u << 30);		// vector count larger than the input
+	RosterChanges delta;
+	std::string fields;
+	putVarint(fields, 1);
+	putVarint(fields, 2);
+	fields += huge;
+	CHECK(!delta.decode(fields));
+}
+
+int main()
+{
+	testVarints();
+	testNetInfoType();
+	testRoundTrips();
+	testVersions();
+	testCorrupted();
+	return checkResult("schema");
+}
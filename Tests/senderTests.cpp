@@ -0,0 +1,84 @@
+#include "check.h"
+#include "../Server/senderPool.h"
+
+// sender workers writing peers whose reader never drains its socket
+
+// returns a peer on one end of a socket pair, the other end is returned in _reader and never read
+static std::shared_ptr<Peer> stalledPeer(SOCKET& _reader)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return nullptr;
+	_reader = fds[1];
+
+	auto peer = std::make_shared<Peer>(fds[0]);
+	peer->user = User(1, "stalled");
+	return peer;
+}
+
+// returns true once _peer is broken (waits up to two seconds)
+static bool waitBroken(const Peer& _peer)
+{
+	for (int i = 0; i < 200 && !_peer.broken; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	return _peer.broken;
+}
+
+static void testStalledReader()
+{
+	OutboundLimits limits;
+	limits.maxBytes = 256 * 1024;
+	limits.grace = std::chrono::milliseconds(100);
+
+	SenderPool pool;
+	pool.setLimits(limits);
+	pool.start(2);
+
+	SOCKET reader;
+	auto peer = stalledPeer(reader);
+	CHECK(peer != nullptr);
+
+	SharedFrame frame = makeFrame(std::string(16 * 1024, 'x'));
+	for (int i = 0; i < 64; i++)					// fills the socket, the rest stays queued over the limits
+		pool.post(peer, frame, FrameClass::critical);
+	CHECK(!peer->broken);							// still within the grace period
+
+	// nothing is posted any more, the worker retrying the full socket has to notice the grace period ran out
+	CHECK(waitBroken(*peer));
+	CHECK(pool.getStats().disconnects == 1);
+
+	pool.stop();
+	closesocket(reader);
+}
+
+static void testStalledUnderLimits()
+{
+	OutboundLimits limits;
+	limits.grace = std::chrono::milliseconds(0);
+
+	SenderPool pool;
+	pool.setLimits(limits);
+	pool.start(1);
+
+	SOCKET reader;
+	auto peer = stalledPeer(reader);
+	CHECK(peer != nullptr);
+
+	SharedFrame frame = makeFrame(std::string(16 * 1024, 'x'));
+	for (int i = 0; i < 64; i++)					// fills the socket, queue stays under the default limits
+		pool.post(peer, frame, FrameClass::critical);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	CHECK(!peer->broken && pool.getStats().disconnects == 0);	// slow, not over its limits
+
+	pool.stop();
+	closesocket(reader);
+}
+
+int main()
+{
+	InitWinSock();
+	testStalledReader();
+	testStalledUnderLimits();
+	return checkResult("sender");
+}